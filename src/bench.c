@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "training.h"
+#include "kernels.h"
+
+#ifdef RNA_FLOAT32
+#define PRECISION "float32"
+#else
+#define PRECISION "float64"
+#endif
+
+double now_secs(void) {
+    struct timespec now;
+    assert(clock_gettime(CLOCK_MONOTONIC, &now) >= 0);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+void print_bench(RNA_Model *model, size_t train_images, double train_secs, size_t test_images, double test_secs, double eval_secs, int correct) {
+    printf("+-----------------------------------+\n");
+    printf("| Benchmark %-23s |\n", PRECISION);
+    printf("+--------------------+--------------+\n");
+    printf("| Kernels            | %12s |\n", kernels.name);
+    printf("| Epochs             | %12d |\n", model->epoch);
+    printf("| Training time      | %10.3f s |\n", train_secs);
+    printf("| Training images/s  | %12.0f |\n", train_images/train_secs);
+    printf("| Forward us/sample  | %12.3f |\n", model->forward_secs*1e6/train_images);
+    printf("| Backward us/sample | %12.3f |\n", model->backward_secs*1e6/train_images);
+    printf("| Inference us/image | %12.3f |\n", test_secs*1e6/test_images);
+    printf("| Batched eval ms    | %12.3f |\n", eval_secs*1e3);
+    printf("| Accuracy           | %11.2f%% |\n", correct*100.0/test_images);
+    printf("+--------------------+--------------+\n");
+}
+
+char* shift(int *argc, char ***argv) {
+    return (*argc)--, *(*argv)++;
+}
+
+void usage(char *program_name) {
+    printf(
+"Usage:\n"
+"  %s [--epochs <n>] [--lr <rate>] [--batch-size <n>] [--threads <n>] [--sync] [--seed <n>] [--mmap] [--loader-threads <n>]\n"
+"  %s --help\n",
+    program_name, program_name);
+
+    printf(
+"\nTrains a model with a fixed seed and reports training throughput, inference latency and test accuracy.\n"
+"\nOptions:\n"
+"  --help               Prints this message.\n"
+"  --epochs <n>         Epochs to train [default: 1].\n"
+"  --lr <rate>          Learning rate [default: 0.2].\n"
+"  --batch-size <n>     Samples per weight update [default: 1].\n"
+"  --threads <n>        Hogwild training workers, 0 = one per core [default: 1].\n"
+"  --sync               Split every minibatch across the threads instead, deterministic for any thread count.\n"
+"  --seed <n>           Seed of the initial weights [default: 0].\n"
+"  --mmap               Map the dataset instead of reading it, pixels stay as bytes.\n"
+"  --loader-threads <n> Threads used to decode the dataset [default: one per core].\n");
+}
+
+int main(int argc, char **argv) {
+    char *program_name = shift(&argc, &argv);
+    RNA_Parameters parameters = get_default_parameters();
+    parameters.max_iters = 1;
+    parameters.lr = 0.2;
+    parameters.tolerance = 0;
+    parameters.output_path = "/dev/null";
+
+    bool map_dataset = false;
+    unsigned int seed = 0;
+    uint32_t loader_threads = 0;
+    while (argc > 0) {
+        char *parameter = shift(&argc, &argv);
+        if (strcmp(parameter, "--help") == 0) {
+            usage(program_name);
+            return 0;
+        } else if (strcmp(parameter, "--mmap") == 0) {
+            map_dataset = true;
+            continue;
+        } else if (strcmp(parameter, "--sync") == 0) {
+            parameters.sync = true;
+            continue;
+        }
+
+        if (argc == 0) {
+            fprintf(stderr, "ERROR: missing parameter '%s' value\n", parameter);
+            usage(program_name);
+            return 1;
+        }
+
+        char *value = shift(&argc, &argv);
+        if (strcmp(parameter, "--epochs") == 0) {
+            parameters.max_iters = atoi(value);
+        } else if (strcmp(parameter, "--lr") == 0) {
+            parameters.lr = atof(value);
+        } else if (strcmp(parameter, "--batch-size") == 0) {
+            parameters.batch_size = atoi(value);
+        } else if (strcmp(parameter, "--threads") == 0) {
+            parameters.threads = atoi(value);
+        } else if (strcmp(parameter, "--seed") == 0) {
+            seed = atoi(value);
+        } else if (strcmp(parameter, "--loader-threads") == 0) {
+            loader_threads = atoi(value);
+        } else {
+            fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
+        }
+    }
+
+    bool (*load_data)(const char *, const char *, Data *) = map_dataset ? map_data : read_data;
+    Data training_data = { .loader_threads = loader_threads };
+    Data testing_data = { .loader_threads = loader_threads };
+    if (!load_data("data/train-images.idx3-ubyte", "data/train-labels.idx1-ubyte", &training_data) ||
+        !load_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &testing_data)
+    ) {
+        return 1;
+    }
+
+    srand(seed);
+    RNA_Model model = { .neuron_cnt = (uint32_t []) {64, 32, 10}, .layer_count = 3, .training_parameters = &parameters };
+    init_model(&model, &training_data);
+
+    double start = now_secs();
+    if (!train_model(&model, &training_data)) {
+        return 1;
+    }
+    double train_secs = now_secs() - start;
+
+    int correct = 0;
+    start = now_secs();
+    for (uint32_t i = 0; i < testing_data.meta.size; i++) {
+        if (find_label_at(&model, &testing_data, i) == testing_data.labels[i]) correct++;
+    }
+    double test_secs = now_secs() - start;
+
+    start = now_secs();
+    size_t eval_correct = evaluate_model(&model, &testing_data, 0, 0);
+    double eval_secs = now_secs() - start;
+    if (eval_correct != (size_t) correct) {
+        fprintf(stderr, "WARNING: batched evaluation got %zu correct labels instead of %d\n", eval_correct, correct);
+    }
+
+    print_bench(
+        &model, (size_t) training_data.meta.size*model.epoch, train_secs,
+        testing_data.meta.size, test_secs, eval_secs, correct
+    );
+
+    denit_model(&model);
+    denit_data(&training_data);
+    denit_data(&testing_data);
+    return 0;
+}
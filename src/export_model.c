@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "training.h"
+
+char* shift(int *argc, char ***argv) {
+    return (*argc)--, *(*argv)++;
+}
+
+void usage(char *program_name) {
+    printf(
+"Usage:\n"
+"  %s --model <model-file> [--out <name>]\n"
+"  %s --help\n",
+    program_name, program_name);
+
+    printf(
+"\nWrites a model as dependency-free C, the same as `training --export-c` without linking raylib.\n"
+"\nOptions:\n"
+"  --help               Prints this message.\n"
+"  --model <file>       Model to export (JRNA v1 or v2).\n"
+"  --out <name>         Writes <name>.c and <name>.h [default: rna_model].\n");
+}
+
+int main(int argc, char **argv) {
+    char *program_name = shift(&argc, &argv);
+    char *model_path = NULL;
+    char *out = "rna_model";
+    while (argc > 0) {
+        char *parameter = shift(&argc, &argv);
+        if (strcmp(parameter, "--help") == 0) {
+            usage(program_name);
+            return 0;
+        }
+
+        if (argc == 0) {
+            fprintf(stderr, "ERROR: missing parameter '%s' value\n", parameter);
+            usage(program_name);
+            return 1;
+        }
+
+        char *value = shift(&argc, &argv);
+        if (strcmp(parameter, "--model") == 0) {
+            model_path = value;
+        } else if (strcmp(parameter, "--out") == 0) {
+            out = value;
+        } else {
+            fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
+        }
+    }
+
+    if (model_path == NULL) {
+        usage(program_name);
+        return 1;
+    }
+
+    RNA_Model model = {0};
+    if (!load_model(model_path, &model)) {
+        return 1;
+    }
+
+    if (!export_model_c(&model, model_path, out)) {
+        fprintf(stderr, "ERROR: failed to export model\n");
+        return 1;
+    }
+
+    printf("INFO: exported model to %s.c and %s.h\n", out, out);
+    denit_model(&model);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "training.h"
+#include "rna_model.h" // generated by `export-model --out rna_model`, see the `export-test` target
+
+// Checks the exported code gives the label of `find_label_at` on every test image, from the
+// normalized images and from the raw pixels
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <model-file>\n", argv[0]);
+        return 1;
+    }
+
+    RNA_Model model = {0};
+    if (!load_model(argv[1], &model)) {
+        return 1;
+    }
+
+    Data images = {0}, pixels = {0};
+    if (!read_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &images) ||
+        !map_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &pixels)) {
+        return 1;
+    }
+
+    if (pixels.meta.rows*pixels.meta.cols != RNA_MODEL_INPUTS || model.weights_cnt[0] != RNA_MODEL_INPUTS) {
+        fprintf(stderr, "ERROR: exported model expects %d inputs, test images have %u\n", RNA_MODEL_INPUTS, pixels.meta.rows*pixels.meta.cols);
+        return 1;
+    }
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < pixels.meta.size; i++) {
+        int label = rna_model_find_label(pixels.pixels + i*pixels.stride);
+        int expected = find_label_at(&model, &images, i);
+        int expected_u8 = find_label_at(&model, &pixels, i);
+        if (label != expected || label != expected_u8) {
+            if (mismatches++ < 10) {
+                fprintf(stderr, "ERROR: image %zu: exported label %d, find_label_at %d (raw pixels %d)\n", i, label, expected, expected_u8);
+            }
+        }
+    }
+
+    printf("INFO: exported model matches find_label_at on %zu/%u test images\n", pixels.meta.size - mismatches, pixels.meta.size);
+    denit_data(&images);
+    denit_data(&pixels);
+    denit_model(&model);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -28,12 +28,15 @@ void mark_mouse_pos(RenderTexture2D *target, Color color) {
     EndTextureMode();
 }
 
-Color * make_screen_pixels(double *image) {
+Color * make_screen_pixels(Data *data, size_t index) {
     static Color __pixels[IMAGE_SIZE][IMAGE_SIZE];
 
+    size_t image_index = index*data->stride;
     for (size_t y = 0; y < IMAGE_SIZE; y++) {
         for (size_t x = 0; x < IMAGE_SIZE; x++) {
-            float pixel = *(image + y*IMAGE_SIZE + x) * 255.0;
+            float pixel = data->pixels != NULL
+                ? data->pixels[image_index + y*IMAGE_SIZE + x]
+                : data->_images[image_index + y*IMAGE_SIZE + x] * 255.0;
             __pixels[y][x].r = pixel;
             __pixels[y][x].g = pixel;
             __pixels[y][x].b = pixel;
@@ -45,8 +48,8 @@ Color * make_screen_pixels(double *image) {
     return (Color *) __pixels;
 }
 
-double *make_image() {
-    static double buffer[IMAGE_SIZE][IMAGE_SIZE];
+Real *make_image() {
+    static Real buffer[IMAGE_SIZE][IMAGE_SIZE];
 
     Image user_draw = ImageFromImage(LoadImageFromScreen(), (Rectangle) {
         .width = WINDOW_SIZE - PADDING*2,
@@ -65,13 +68,13 @@ double *make_image() {
         }
     }
 
-    return (double*) buffer;
+    return (Real*) buffer;
 }
 
-void draw_card(int i, int current_image, int total_cards, float xoffset_cards, double *images, Texture2D texture) {
+void draw_card(int i, int current_image, int total_cards, float xoffset_cards, Data *data, Texture2D texture) {
     int image_i = current_image + i - total_cards/2;
     if (image_i >= 0) {
-        UpdateTexture(texture, make_screen_pixels(images + (int)(image_i*IMAGE_SIZE*IMAGE_SIZE)));
+        UpdateTexture(texture, make_screen_pixels(data, image_i));
 
         DrawTexturePro(
             texture,
@@ -93,14 +96,15 @@ void draw_card(int i, int current_image, int total_cards, float xoffset_cards, d
     );
 }
 
-bool load_model_and_init_test_gui(char *model_path) {
+bool load_model_and_init_test_gui(char *model_path, bool map_dataset, uint32_t loader_threads) {
     RNA_Model model = {0};
-    if (!load_model(model_path, &model)) {
+    if (!map_model(model_path, &model)) {
         return false;
     }
 
-    Data testing_data = {0};
-    if (!read_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &testing_data)) {
+    Data testing_data = { .loader_threads = loader_threads };
+    bool (*load_data)(const char *, const char *, Data *) = map_dataset ? map_data : read_data;
+    if (!load_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &testing_data)) {
         return false;
     }
 
@@ -125,9 +129,8 @@ bool load_model_and_init_test_gui(char *model_path) {
 
     RenderTexture2D target = LoadRenderTexture(WINDOW_SIZE - PADDING*2, WINDOW_SIZE - PADDING*2);
 
-    int8_t guess = find_label(&model, testing_data._images);
-    UpdateTexture(texture, make_screen_pixels(testing_data._images));
-    size_t image_index = 0;
+    int8_t guess = find_label_at(&model, &testing_data, 0);
+    UpdateTexture(texture, make_screen_pixels(&testing_data, 0));
     bool drawining_mode = false;
     bool clear_screen = false;
 
@@ -150,7 +153,7 @@ bool load_model_and_init_test_gui(char *model_path) {
             }
 
             if (IsKeyPressed(KEY_SPACE))  {
-                double *image = make_image();
+                Real *image = make_image();
                 label = find_label(&model, image);
             }
 
@@ -187,14 +190,12 @@ bool load_model_and_init_test_gui(char *model_path) {
         } else {
             if (IsKeyPressed(KEY_RIGHT) && current_image < testing_data.meta.size) {
                 current_image++;
-                image_index = current_image*IMAGE_SIZE*IMAGE_SIZE;
-                guess = find_label(&model, testing_data._images + image_index);
-                UpdateTexture(texture, make_screen_pixels(testing_data._images + image_index));
+                guess = find_label_at(&model, &testing_data, current_image);
+                UpdateTexture(texture, make_screen_pixels(&testing_data, current_image));
             } else if (IsKeyPressed(KEY_LEFT) && current_image > 0) {
                 current_image--;
-                image_index = current_image*IMAGE_SIZE*IMAGE_SIZE;
-                guess = find_label(&model, testing_data._images + image_index);
-                UpdateTexture(texture, make_screen_pixels(testing_data._images + image_index));
+                guess = find_label_at(&model, &testing_data, current_image);
+                UpdateTexture(texture, make_screen_pixels(&testing_data, current_image));
             }
 
             BeginDrawing();
@@ -229,13 +230,13 @@ bool load_model_and_init_test_gui(char *model_path) {
 
             // Cards
             for (size_t i = 0; i < total_cards/2; i++) {
-                draw_card(i, current_image, total_cards, xoffset_cards, testing_data._images, card_textures[i]);
+                draw_card(i, current_image, total_cards, xoffset_cards, &testing_data, card_textures[i]);
             }
 
-            draw_card(total_cards/2, current_image, total_cards, xoffset_cards, testing_data._images, card_textures[total_cards/2]);
+            draw_card(total_cards/2, current_image, total_cards, xoffset_cards, &testing_data, card_textures[total_cards/2]);
 
             for (size_t i = (total_cards/2) + 1; i < total_cards; i++) {
-                draw_card(i, current_image, total_cards, xoffset_cards, testing_data._images, card_textures[i]);
+                draw_card(i, current_image, total_cards, xoffset_cards, &testing_data, card_textures[i]);
             }
 
             DrawRectangleLines(PADDING, PADDING, WINDOW_SIZE - PADDING*2, WINDOW_SIZE - PADDING*2, WHITE);
@@ -257,14 +258,16 @@ char* shift(int *argc, char ***argv) {
 void usage(char *program_name) {
     printf(
 "Usage:\n"
-"  %s --model <model-file>\n"
+"  %s --model <model-file> [--mmap] [--loader-threads <n>]\n"
 "  %s --help\n",
     program_name, program_name);
 
     printf(
 "\nOptions:\n"
 "  --help               Prints this message.\n"
-"  --model <file>       Input model file.\n");
+"  --model <file>       Input model file.\n"
+"  --mmap               Map the test images instead of reading them, pixels stay as bytes.\n"
+"  --loader-threads <n> Threads used to decode the test images [default: one per core].\n");
 }
 
 int main(int argc, char **argv) {
@@ -283,7 +286,20 @@ int main(int argc, char **argv) {
         }
 
         char *model_path = shift(&argc, &argv);
-        if (!load_model_and_init_test_gui(model_path)) {
+        bool map_dataset = false;
+        uint32_t loader_threads = 0;
+        while (argc > 0) {
+            char *parameter = shift(&argc, &argv);
+            if (strcmp(parameter, "--mmap") == 0) {
+                map_dataset = true;
+            } else if (strcmp(parameter, "--loader-threads") == 0 && argc > 0) {
+                loader_threads = atoi(shift(&argc, &argv));
+            } else {
+                fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
+            }
+        }
+
+        if (!load_model_and_init_test_gui(model_path, map_dataset, loader_threads)) {
             fprintf(stderr, "ERROR: could not initialize GUI");
             return 1;
         }
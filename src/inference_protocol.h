@@ -0,0 +1,13 @@
+#ifndef INFERENCE_PROTOCOL_H
+#define INFERENCE_PROTOCOL_H
+
+// Wire format of the inference server: a client writes any number of requests on a Unix stream
+// socket, each one the 28x28 raw pixels (0..255, row major) of an image, and reads one byte per
+// request back, the label (0..9) of each image in the order they were sent
+
+#define INFERENCE_IMAGE_ROWS 28
+#define INFERENCE_IMAGE_COLS 28
+#define INFERENCE_IMAGE_SIZE (INFERENCE_IMAGE_ROWS*INFERENCE_IMAGE_COLS)
+#define INFERENCE_DEFAULT_SOCKET "/tmp/rna-inference.sock"
+
+#endif // INFERENCE_PROTOCOL_H
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "training.h"
+#include "inference_protocol.h"
+
+#define MAX_BATCHERS 64
+#define LATENCY_WINDOW 65536 // latest request latencies kept for the percentiles
+
+typedef struct Request {
+    const uint8_t *pixels;     // INFERENCE_IMAGE_SIZE bytes in the read buffer of its connection
+    uint8_t label;
+    bool done;
+    double enqueued;
+    pthread_cond_t finished;
+    struct Request *next;
+} Request;
+
+typedef struct Connection {
+    struct Server *server;
+    int fd;
+    struct Connection *next;   // open connections, guarded by the server `lock`
+    struct Connection *prev;
+} Connection;
+
+// Requests of every connection wait here until a batcher takes them. A batcher starts a
+// micro-batch with the oldest request and waits for more until the batch is full or the
+// oldest one has waited `budget_secs`, then runs the whole batch through one forward pass
+typedef struct Server {
+    RNA_Model *model;
+    size_t max_batch;
+    double budget_secs;
+    double report_secs;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    Request *head;
+    Request *tail;
+    size_t pending;
+    bool closing;              // no new requests are queued, batchers exit once the queue is empty
+    Connection *connections;
+    pthread_cond_t closed;     // signaled when a connection ends
+
+    // counters since the last report, guarded by `lock`
+    double latencies[LATENCY_WINDOW]; // seconds
+    size_t served;
+    size_t batches;
+    double last_report;
+} Server;
+
+// SIGINT and SIGTERM write to it, the accept loop polls it along with the listener
+static int stop_pipe[2] = {-1, -1};
+
+double now_secs(void) {
+    struct timespec now;
+    assert(clock_gettime(CLOCK_MONOTONIC, &now) >= 0);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+struct timespec deadline_at(double secs) {
+    // condition variables wait on the realtime clock
+    struct timespec now;
+    assert(clock_gettime(CLOCK_REALTIME, &now) >= 0);
+    double wait = secs - now_secs();
+    if (wait < 0) wait = 0;
+    long nsec = now.tv_nsec + (long) ((wait - (long) wait)*1e9);
+    return (struct timespec) { .tv_sec = now.tv_sec + (long) wait + nsec/1000000000, .tv_nsec = nsec%1000000000 };
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Prints the counters gathered since the last report and resets them, called with `lock` held
+void report_stats(Server *server) {
+    double now = now_secs();
+    double elapsed = now - server->last_report;
+    size_t samples = server->served < LATENCY_WINDOW ? server->served : LATENCY_WINDOW;
+    if (samples > 0) {
+        qsort(server->latencies, samples, sizeof(*server->latencies), compare_doubles);
+        printf(
+            "INFO: %zu requests in %.1f s (%.0f req/s), avg batch %.1f, latency p50 %.3f ms p99 %.3f ms\n",
+            server->served, elapsed, server->served/elapsed, (double) server->served/server->batches,
+            server->latencies[samples/2]*1e3, server->latencies[samples*99/100]*1e3
+        );
+        fflush(stdout);
+    }
+
+    server->served = 0;
+    server->batches = 0;
+    server->last_report = now;
+}
+
+void *batcher(void *args) {
+    Server *server = (Server *) args;
+    void *workspace = malloc(inference_workspace_size(server->model, server->max_batch));
+    assert(workspace != NULL);
+    uint8_t *pixels = malloc(server->max_batch * INFERENCE_IMAGE_SIZE);
+    assert(pixels != NULL);
+    uint8_t *labels = malloc(server->max_batch);
+    assert(labels != NULL);
+    Request **batch = malloc(sizeof(*batch) * server->max_batch);
+    assert(batch != NULL);
+
+    Data images = {
+        .meta = { .rows = INFERENCE_IMAGE_ROWS, .cols = INFERENCE_IMAGE_COLS },
+        .stride = INFERENCE_IMAGE_SIZE,
+        .pixels = pixels,
+    };
+
+    pthread_mutex_lock(&server->lock);
+    while (!server->closing || server->pending > 0) {
+        if (server->pending == 0) {
+            struct timespec report = deadline_at(server->last_report + server->report_secs);
+            pthread_cond_timedwait(&server->queued, &server->lock, &report);
+        } else if (!server->closing && server->pending < server->max_batch && now_secs() < server->head->enqueued + server->budget_secs) {
+            struct timespec budget = deadline_at(server->head->enqueued + server->budget_secs);
+            pthread_cond_timedwait(&server->queued, &server->lock, &budget);
+        } else {
+            size_t count = 0;
+            while (count < server->max_batch && server->head != NULL) {
+                batch[count++] = server->head;
+                server->head = server->head->next;
+            }
+
+            if (server->head == NULL) server->tail = NULL;
+            server->pending -= count;
+            pthread_mutex_unlock(&server->lock);
+
+            // requests stay alive until they are marked as done, so they can be read unlocked
+            for (size_t i = 0; i < count; i++) {
+                memcpy(pixels + i*INFERENCE_IMAGE_SIZE, batch[i]->pixels, INFERENCE_IMAGE_SIZE);
+            }
+
+            images.meta.size = count;
+            infer_batch(server->model, &images, 0, count, workspace, labels, NULL);
+
+            pthread_mutex_lock(&server->lock);
+            double now = now_secs();
+            for (size_t i = 0; i < count; i++) {
+                server->latencies[server->served++ % LATENCY_WINDOW] = now - batch[i]->enqueued;
+                batch[i]->label = labels[i];
+                batch[i]->done = true;
+                pthread_cond_signal(&batch[i]->finished);
+            }
+            server->batches++;
+        }
+
+        if (now_secs() >= server->last_report + server->report_secs) {
+            report_stats(server);
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    free(batch);
+    free(labels);
+    free(pixels);
+    free(workspace);
+    return NULL;
+}
+
+// Waits until `buffer` holds at least one whole request, then adds whatever else the client
+// already sent without blocking, up to `capacity` bytes. Returns the bytes in `buffer`, 0 once
+// the client is gone
+size_t read_requests(int fd, uint8_t *buffer, size_t filled, size_t capacity) {
+    while (filled < INFERENCE_IMAGE_SIZE) {
+        ssize_t n = read(fd, buffer + filled, capacity - filled);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        filled += n;
+    }
+
+    while (filled < capacity) {
+        ssize_t n = recv(fd, buffer + filled, capacity - filled, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        filled += n;
+    }
+
+    return filled;
+}
+
+bool write_all(int fd, const void *buffer, size_t size) {
+    for (size_t done = 0; done < size;) {
+        ssize_t n = write(fd, (const uint8_t *) buffer + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+
+    return true;
+}
+
+// Every whole request that arrived on the connection is queued at once, up to `max_batch`, so a
+// client pipelining its images fills micro-batches by itself. Labels are written back in order
+void *serve_connection(void *args) {
+    Connection *connection = (Connection *) args;
+    Server *server = connection->server;
+    size_t capacity = server->max_batch * INFERENCE_IMAGE_SIZE;
+    uint8_t *buffer = malloc(capacity);
+    assert(buffer != NULL);
+    uint8_t *labels = malloc(server->max_batch);
+    assert(labels != NULL);
+    Request *requests = calloc(server->max_batch, sizeof(*requests));
+    assert(requests != NULL);
+    for (size_t i = 0; i < server->max_batch; i++) {
+        pthread_cond_init(&requests[i].finished, NULL);
+    }
+
+    size_t filled = 0;
+    while ((filled = read_requests(connection->fd, buffer, filled, capacity)) > 0) {
+        size_t count = filled / INFERENCE_IMAGE_SIZE;
+        pthread_mutex_lock(&server->lock);
+        if (server->closing) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+
+        double now = now_secs();
+        for (size_t i = 0; i < count; i++) {
+            Request *request = &requests[i];
+            request->pixels = buffer + i*INFERENCE_IMAGE_SIZE;
+            request->done = false;
+            request->next = NULL;
+            request->enqueued = now;
+            if (server->tail != NULL) {
+                server->tail->next = request;
+            } else {
+                server->head = request;
+            }
+            server->tail = request;
+        }
+        server->pending += count;
+        pthread_cond_signal(&server->queued);
+
+        for (size_t i = 0; i < count; i++) {
+            while (!requests[i].done) {
+                pthread_cond_wait(&requests[i].finished, &server->lock);
+            }
+            labels[i] = requests[i].label;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (!write_all(connection->fd, labels, count)) {
+            break;
+        }
+
+        // the start of a request that did not fully arrive yet
+        filled -= count*INFERENCE_IMAGE_SIZE;
+        memmove(buffer, buffer + count*INFERENCE_IMAGE_SIZE, filled);
+    }
+
+    for (size_t i = 0; i < server->max_batch; i++) {
+        pthread_cond_destroy(&requests[i].finished);
+    }
+    free(requests);
+    free(labels);
+    free(buffer);
+    pthread_mutex_lock(&server->lock);
+    if (connection->prev != NULL) {
+        connection->prev->next = connection->next;
+    } else {
+        server->connections = connection->next;
+    }
+    if (connection->next != NULL) connection->next->prev = connection->prev;
+    pthread_cond_signal(&server->closed);
+    pthread_mutex_unlock(&server->lock);
+
+    close(connection->fd);
+    free(connection);
+    return NULL;
+}
+
+void handle_stop(int signal) {
+    (void) signal;
+    int saved_errno = errno;
+    ssize_t n = write(stop_pipe[1], "", 1);
+    (void) n;
+    errno = saved_errno;
+}
+
+// Server threads keep SIGINT and SIGTERM blocked, only the main thread handles them
+void create_thread(pthread_t *handle, void *(*routine)(void *), void *args) {
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    pthread_create(handle, NULL, routine, args);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+char* shift(int *argc, char ***argv) {
+    return (*argc)--, *(*argv)++;
+}
+
+void usage(char *program_name) {
+    printf(
+"Usage:\n"
+"  %s --model <model-file> [--socket <path>] [--max-batch <n>] [--budget-us <n>] [--batchers <n>] [--report-secs <n>]\n"
+"  %s --help\n",
+    program_name, program_name);
+
+    printf(
+"\nServes a model on a Unix socket: clients send 28x28 raw pixel images and read back one label byte per image.\n"
+"Concurrent requests are grouped in micro-batches that run through a single batched forward pass.\n"
+"\nOptions:\n"
+"  --help               Prints this message.\n"
+"  --model <file>       Model to serve.\n"
+"  --socket <path>      Socket to listen on [default: " INFERENCE_DEFAULT_SOCKET "].\n"
+"  --max-batch <n>      Largest micro-batch [default: 64].\n"
+"  --budget-us <n>      Longest a request waits for its batch to fill, in microseconds [default: 1000].\n"
+"  --batchers <n>       Threads running batches, each one with its own workspace [default: 1].\n"
+"  --report-secs <n>    Seconds between throughput and p50/p99 latency reports [default: 5].\n");
+}
+
+int main(int argc, char **argv) {
+    char *program_name = shift(&argc, &argv);
+    char *model_path = NULL;
+    char *socket_path = INFERENCE_DEFAULT_SOCKET;
+    size_t max_batch = 64;
+    double budget_us = 1000;
+    uint32_t batchers = 1;
+    double report_secs = 5;
+    while (argc > 0) {
+        char *parameter = shift(&argc, &argv);
+        if (strcmp(parameter, "--help") == 0) {
+            usage(program_name);
+            return 0;
+        }
+
+        if (argc == 0) {
+            fprintf(stderr, "ERROR: missing parameter '%s' value\n", parameter);
+            usage(program_name);
+            return 1;
+        }
+
+        char *value = shift(&argc, &argv);
+        if (strcmp(parameter, "--model") == 0) {
+            model_path = value;
+        } else if (strcmp(parameter, "--socket") == 0) {
+            socket_path = value;
+        } else if (strcmp(parameter, "--max-batch") == 0) {
+            max_batch = atoi(value);
+        } else if (strcmp(parameter, "--budget-us") == 0) {
+            budget_us = atof(value);
+        } else if (strcmp(parameter, "--batchers") == 0) {
+            batchers = atoi(value);
+        } else if (strcmp(parameter, "--report-secs") == 0) {
+            report_secs = atof(value);
+        } else {
+            fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
+        }
+    }
+
+    if (model_path == NULL) {
+        fprintf(stderr, "ERROR: missing parameter '--model'\n");
+        usage(program_name);
+        return 1;
+    }
+
+    if (max_batch == 0) max_batch = 1;
+    if (batchers == 0) batchers = 1;
+    if (batchers > MAX_BATCHERS) batchers = MAX_BATCHERS;
+
+    RNA_Model model = {0};
+    if (!map_model(model_path, &model)) {
+        return 1;
+    }
+
+    if (model.weights_cnt[0] != INFERENCE_IMAGE_SIZE) {
+        fprintf(stderr, "ERROR: model %s takes %u inputs, expected %dx%d images\n", model_path, model.weights_cnt[0], INFERENCE_IMAGE_ROWS, INFERENCE_IMAGE_COLS);
+        return 1;
+    }
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "ERROR: socket path %s is too long\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 128) < 0) {
+        fprintf(stderr, "ERROR: cannot listen on %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    // whichever thread a signal lands on, the byte it writes wakes up the accept loop
+    if (pipe(stop_pipe) < 0) {
+        fprintf(stderr, "ERROR: cannot create the stop pipe: %s\n", strerror(errno));
+        return 1;
+    }
+    fcntl(stop_pipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction stop = { .sa_handler = handle_stop };
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    static Server server;
+    server.model = &model;
+    server.max_batch = max_batch;
+    server.budget_secs = budget_us/1e6;
+    server.report_secs = report_secs;
+    server.last_report = now_secs();
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.queued, NULL);
+    pthread_cond_init(&server.closed, NULL);
+
+    pthread_t handles[MAX_BATCHERS];
+    for (uint32_t i = 0; i < batchers; i++) {
+        create_thread(&handles[i], batcher, (void *) &server);
+    }
+
+    printf("INFO: serving %s on %s (max batch %zu, budget %.0f us, %u batchers)\n", model_path, socket_path, max_batch, budget_us, batchers);
+    fflush(stdout);
+    struct pollfd fds[] = {
+        { .fd = listener, .events = POLLIN },
+        { .fd = stop_pipe[0], .events = POLLIN },
+    };
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno != EINTR) fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+            continue;
+        }
+
+        if (fds[1].revents != 0) break;
+        if (fds[0].revents == 0) continue;
+
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) fprintf(stderr, "ERROR: accept failed: %s\n", strerror(errno));
+            continue;
+        }
+
+        Connection *connection = malloc(sizeof(*connection));
+        assert(connection != NULL);
+        pthread_mutex_lock(&server.lock);
+        *connection = (Connection) { .server = &server, .fd = fd, .next = server.connections };
+        if (server.connections != NULL) server.connections->prev = connection;
+        server.connections = connection;
+        pthread_mutex_unlock(&server.lock);
+
+        pthread_t handle;
+        create_thread(&handle, serve_connection, (void *) connection);
+        pthread_detach(handle);
+    }
+
+    // queued requests are still answered, then every connection is shut down so its reader returns
+    pthread_mutex_lock(&server.lock);
+    server.closing = true;
+    for (Connection *connection = server.connections; connection != NULL; connection = connection->next) {
+        shutdown(connection->fd, SHUT_RD);
+    }
+    pthread_cond_broadcast(&server.queued);
+    pthread_mutex_unlock(&server.lock);
+    for (uint32_t i = 0; i < batchers; i++) {
+        pthread_join(handles[i], NULL);
+    }
+
+    pthread_mutex_lock(&server.lock);
+    while (server.connections != NULL) {
+        pthread_cond_wait(&server.closed, &server.lock);
+    }
+    report_stats(&server);
+    pthread_mutex_unlock(&server.lock);
+
+    printf("INFO: shutting down\n");
+    close(listener);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    unlink(socket_path);
+    denit_model(&model);
+    return 0;
+}
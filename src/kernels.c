@@ -0,0 +1,483 @@
+#include "kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Kernels kernels;
+
+// cache blocking of the GEMM kernels, see kernels_template.h
+#define GEMM_NT_ROWS 16  // rows of B (weights) kept hot while the batch streams past them
+#define GEMM_ACC_COLS 64 // columns of B kept hot for every row of C
+
+// Portable fallback, also the reference the SIMD versions are checked against
+
+static Real dot_scalar(const Real *a, const Real *b, size_t cnt) {
+    Real sum = 0;
+
+    for (size_t i = 0; i + 3 < cnt; i += 4) {
+        sum += a[i]   * b[i]
+             + a[i+1] * b[i+1]
+             + a[i+2] * b[i+2]
+             + a[i+3] * b[i+3];
+    }
+
+    size_t remaning = cnt % 4;
+    for (size_t i = 0; i < remaning; i++) {
+        sum += a[cnt - 1 - i] * b[cnt - 1 - i];
+    }
+
+    return sum;
+}
+
+static Real dot_u8_scalar(const Real *weights, const uint8_t *pixels, size_t cnt) {
+    Real sum = 0;
+
+    for (size_t i = 0; i + 3 < cnt; i += 4) {
+        sum += weights[i]   * pixels[i]
+             + weights[i+1] * pixels[i+1]
+             + weights[i+2] * pixels[i+2]
+             + weights[i+3] * pixels[i+3];
+    }
+
+    size_t remaning = cnt % 4;
+    for (size_t i = 0; i < remaning; i++) {
+        sum += weights[cnt - 1 - i] * pixels[cnt - 1 - i];
+    }
+
+    return sum;
+}
+
+static void axpy_scalar(Real *y, Real a, const Real *x, size_t cnt) {
+    for (size_t i = 0; i < cnt; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static void axpy_fused_scalar(Real *y, Real b, Real *w, Real a, const Real *x, size_t cnt) {
+    for (size_t i = 0; i < cnt; i++) {
+        y[i] += b * w[i];
+        w[i] += a * x[i];
+    }
+}
+
+static void axpy_u8_scalar(Real *y, Real a, const uint8_t *pixels, size_t cnt) {
+    for (size_t i = 0; i < cnt; i++) {
+        y[i] += a * pixels[i];
+    }
+}
+
+static void sigmoid_scalar(Real *values, size_t cnt) {
+    for (size_t i = 0; i < cnt; i++) {
+        Real magnitude = values[i] < 0 ? -values[i] : values[i]; // fabs would promote floats to double
+        values[i] = (Real) .5 * (values[i] / (1 + magnitude) + 1);
+    }
+}
+
+static void gemm_nt_scalar(size_t m, size_t n, size_t k, const Real *a, size_t lda, const Real *b, size_t ldb, Real *c, size_t ldc) {
+    for (size_t j0 = 0; j0 < n; j0 += GEMM_NT_ROWS) {
+        size_t j_end = j0 + GEMM_NT_ROWS < n ? j0 + GEMM_NT_ROWS : n;
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = j0; j < j_end; j++) {
+                c[i*ldc + j] = dot_scalar(a + i*lda, b + j*ldb, k);
+            }
+        }
+    }
+}
+
+static void gemm_acc_scalar(size_t m, size_t n, size_t k, const Real *a, size_t a_row, size_t a_col, const Real *b, size_t ldb, Real *c, size_t ldc) {
+    for (size_t j0 = 0; j0 < n; j0 += GEMM_ACC_COLS) {
+        size_t j_end = j0 + GEMM_ACC_COLS < n ? j0 + GEMM_ACC_COLS : n;
+        for (size_t i = 0; i < m; i++) {
+            for (size_t p = 0; p < k; p++) {
+                axpy_scalar(c + i*ldc + j0, a[i*a_row + p*a_col], b + p*ldb + j0, j_end - j0);
+            }
+        }
+    }
+}
+
+static void gemv_q8_scalar(size_t rows, size_t cnt, const int8_t *weights, size_t stride, const uint8_t *activations, int32_t *out) {
+    for (size_t r = 0; r < rows; r++) {
+        const int8_t *row = weights + r*stride;
+        int32_t sum = 0;
+        for (size_t i = 0; i < cnt; i++) {
+            sum += activations[i] * row[i];
+        }
+
+        out[r] = sum;
+    }
+}
+
+static const Kernels scalar_kernels = {
+    .name = "scalar",
+    .dot = dot_scalar,
+    .dot_u8 = dot_u8_scalar,
+    .axpy = axpy_scalar,
+    .axpy_u8 = axpy_u8_scalar,
+    .axpy_fused = axpy_fused_scalar,
+    .sigmoid = sigmoid_scalar,
+    .gemm_nt = gemm_nt_scalar,
+    .gemm_acc = gemm_acc_scalar,
+    .gemv_q8 = gemv_q8_scalar,
+};
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f,fma")))
+
+static inline __m128i load_u8x4(const uint8_t *pixels) {
+    int32_t bytes;
+    memcpy(&bytes, pixels, sizeof(bytes));
+    return _mm_cvtsi32_si128(bytes);
+}
+
+#ifdef RNA_FLOAT32
+
+// SSE2: 4 floats
+static inline __m128 sse2_load_u8(const uint8_t *pixels) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(load_u8x4(pixels), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+static inline float sse2_hsum(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+#define TARGET
+#define KERNEL(name) name##_sse2
+#define VEC __m128
+#define WIDTH 4
+#define V_ZERO() _mm_setzero_ps()
+#define V_SET1(x) _mm_set1_ps(x)
+#define V_LOADU(p) _mm_loadu_ps(p)
+#define V_STOREU(p, v) _mm_storeu_ps(p, v)
+#define V_LOAD_U8(p) sse2_load_u8(p)
+#define V_ADD(a, b) _mm_add_ps(a, b)
+#define V_MUL(a, b) _mm_mul_ps(a, b)
+#define V_DIV(a, b) _mm_div_ps(a, b)
+#define V_FMADD(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#define V_ABS(v) _mm_andnot_ps(_mm_set1_ps(-0.0f), v)
+#define V_HSUM(v) sse2_hsum(v)
+#include "kernels_template.h"
+
+// AVX2: 8 floats
+TARGET_AVX2 static inline __m256 avx2_load_u8(const uint8_t *pixels) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) pixels)));
+}
+
+TARGET_AVX2 static inline float avx2_hsum(__m256 v) {
+    return sse2_hsum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+#define TARGET TARGET_AVX2
+#define KERNEL(name) name##_avx2
+#define VEC __m256
+#define WIDTH 8
+#define V_ZERO() _mm256_setzero_ps()
+#define V_SET1(x) _mm256_set1_ps(x)
+#define V_LOADU(p) _mm256_loadu_ps(p)
+#define V_STOREU(p, v) _mm256_storeu_ps(p, v)
+#define V_LOAD_U8(p) avx2_load_u8(p)
+#define V_ADD(a, b) _mm256_add_ps(a, b)
+#define V_MUL(a, b) _mm256_mul_ps(a, b)
+#define V_DIV(a, b) _mm256_div_ps(a, b)
+#define V_FMADD(a, b, c) _mm256_fmadd_ps(a, b, c)
+#define V_ABS(v) _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v)
+#define V_HSUM(v) avx2_hsum(v)
+#include "kernels_template.h"
+
+// AVX-512: 16 floats
+TARGET_AVX512 static inline __m512 avx512_load_u8(const uint8_t *pixels) {
+    return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) pixels)));
+}
+
+#define TARGET TARGET_AVX512
+#define KERNEL(name) name##_avx512
+#define VEC __m512
+#define WIDTH 16
+#define V_ZERO() _mm512_setzero_ps()
+#define V_SET1(x) _mm512_set1_ps(x)
+#define V_LOADU(p) _mm512_loadu_ps(p)
+#define V_STOREU(p, v) _mm512_storeu_ps(p, v)
+#define V_LOAD_U8(p) avx512_load_u8(p)
+#define V_ADD(a, b) _mm512_add_ps(a, b)
+#define V_MUL(a, b) _mm512_mul_ps(a, b)
+#define V_DIV(a, b) _mm512_div_ps(a, b)
+#define V_FMADD(a, b, c) _mm512_fmadd_ps(a, b, c)
+#define V_ABS(v) _mm512_abs_ps(v)
+#define V_HSUM(v) _mm512_reduce_add_ps(v)
+#include "kernels_template.h"
+
+#else // double
+
+// SSE2: 2 doubles
+static inline __m128d sse2_load_u8(const uint8_t *pixels) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(load_u8x4(pixels), zero);
+    return _mm_cvtepi32_pd(_mm_unpacklo_epi16(words, zero));
+}
+
+static inline double sse2_hsum(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+#define TARGET
+#define KERNEL(name) name##_sse2
+#define VEC __m128d
+#define WIDTH 2
+#define V_ZERO() _mm_setzero_pd()
+#define V_SET1(x) _mm_set1_pd(x)
+#define V_LOADU(p) _mm_loadu_pd(p)
+#define V_STOREU(p, v) _mm_storeu_pd(p, v)
+#define V_LOAD_U8(p) sse2_load_u8(p)
+#define V_ADD(a, b) _mm_add_pd(a, b)
+#define V_MUL(a, b) _mm_mul_pd(a, b)
+#define V_DIV(a, b) _mm_div_pd(a, b)
+#define V_FMADD(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+#define V_ABS(v) _mm_andnot_pd(_mm_set1_pd(-0.0), v)
+#define V_HSUM(v) sse2_hsum(v)
+#include "kernels_template.h"
+
+// AVX2: 4 doubles
+TARGET_AVX2 static inline __m256d avx2_load_u8(const uint8_t *pixels) {
+    return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(load_u8x4(pixels)));
+}
+
+TARGET_AVX2 static inline double avx2_hsum(__m256d v) {
+    return sse2_hsum(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1)));
+}
+
+#define TARGET TARGET_AVX2
+#define KERNEL(name) name##_avx2
+#define VEC __m256d
+#define WIDTH 4
+#define V_ZERO() _mm256_setzero_pd()
+#define V_SET1(x) _mm256_set1_pd(x)
+#define V_LOADU(p) _mm256_loadu_pd(p)
+#define V_STOREU(p, v) _mm256_storeu_pd(p, v)
+#define V_LOAD_U8(p) avx2_load_u8(p)
+#define V_ADD(a, b) _mm256_add_pd(a, b)
+#define V_MUL(a, b) _mm256_mul_pd(a, b)
+#define V_DIV(a, b) _mm256_div_pd(a, b)
+#define V_FMADD(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define V_ABS(v) _mm256_andnot_pd(_mm256_set1_pd(-0.0), v)
+#define V_HSUM(v) avx2_hsum(v)
+#include "kernels_template.h"
+
+// AVX-512: 8 doubles
+TARGET_AVX512 static inline __m512d avx512_load_u8(const uint8_t *pixels) {
+    return _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) pixels)));
+}
+
+#define TARGET TARGET_AVX512
+#define KERNEL(name) name##_avx512
+#define VEC __m512d
+#define WIDTH 8
+#define V_ZERO() _mm512_setzero_pd()
+#define V_SET1(x) _mm512_set1_pd(x)
+#define V_LOADU(p) _mm512_loadu_pd(p)
+#define V_STOREU(p, v) _mm512_storeu_pd(p, v)
+#define V_LOAD_U8(p) avx512_load_u8(p)
+#define V_ADD(a, b) _mm512_add_pd(a, b)
+#define V_MUL(a, b) _mm512_mul_pd(a, b)
+#define V_DIV(a, b) _mm512_div_pd(a, b)
+#define V_FMADD(a, b, c) _mm512_fmadd_pd(a, b, c)
+#define V_ABS(v) _mm512_abs_pd(v)
+#define V_HSUM(v) _mm512_reduce_add_pd(v)
+#include "kernels_template.h"
+
+#endif // RNA_FLOAT32
+
+// int8 kernels do not depend on Real, the dispatch picks them on their own (see `select_kernels`)
+
+static inline int32_t sse2_hsum_epi32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+// SSE2 has no pmaddubsw: both operands are widened to 16 bits for pmaddwd
+static inline __m128i sse2_madd_q8(__m128i a, __m128i w) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i w_lo = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8);
+    __m128i w_hi = _mm_srai_epi16(_mm_unpackhi_epi8(w, w), 8);
+    return _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(a, zero), w_lo), _mm_madd_epi16(_mm_unpackhi_epi8(a, zero), w_hi));
+}
+
+// pmaddubsw multiplies u8 by s8 and adds pairs to 16 bits, pmaddwd by ones widens them to 32
+TARGET_AVX2 static inline __m256i avx2_madd_q8(__m256i a, __m256i w) {
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(a, w), _mm256_set1_epi16(1));
+}
+
+TARGET_AVX2 static inline int32_t avx2_hsum_epi32(__m256i v) {
+    return sse2_hsum_epi32(_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+#define TARGET_AVX512BW __attribute__((target("avx512f,avx512bw")))
+#define TARGET_AVX512VNNI __attribute__((target("avx512f,avx512bw,avx512vnni")))
+
+TARGET_AVX512BW static inline __m512i avx512_madd_q8(__m512i acc, __m512i a, __m512i w) {
+    return _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_maddubs_epi16(a, w), _mm512_set1_epi16(1)));
+}
+
+// vpdpbusd does the u8 x s8 products and the 32 bit accumulation in one instruction
+TARGET_AVX512VNNI static inline __m512i vnni_madd_q8(__m512i acc, __m512i a, __m512i w) {
+    return _mm512_dpbusd_epi32(acc, a, w);
+}
+
+TARGET_AVX512BW static inline __mmask64 avx512_tail_mask(size_t left) {
+    return left >= 64 ? ~(__mmask64) 0 : ((__mmask64) 1 << left) - 1;
+}
+
+// The GEMV kernels run 4 rows at a time: every activation load feeds 4 independent accumulators,
+// which also hides the latency of the multiply-add chains
+static void gemv_q8_sse2(size_t rows, size_t cnt, const int8_t *weights, size_t stride, const uint8_t *activations, int32_t *out) {
+    size_t r = 0;
+    for (; r + 4 <= rows; r += 4) {
+        const int8_t *w0 = weights + r*stride, *w1 = w0 + stride, *w2 = w1 + stride, *w3 = w2 + stride;
+        __m128i acc0 = _mm_setzero_si128(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+        size_t i = 0;
+        for (; i + 16 <= cnt; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (activations + i));
+            acc0 = _mm_add_epi32(acc0, sse2_madd_q8(a, _mm_loadu_si128((const __m128i *) (w0 + i))));
+            acc1 = _mm_add_epi32(acc1, sse2_madd_q8(a, _mm_loadu_si128((const __m128i *) (w1 + i))));
+            acc2 = _mm_add_epi32(acc2, sse2_madd_q8(a, _mm_loadu_si128((const __m128i *) (w2 + i))));
+            acc3 = _mm_add_epi32(acc3, sse2_madd_q8(a, _mm_loadu_si128((const __m128i *) (w3 + i))));
+        }
+
+        out[r] = sse2_hsum_epi32(acc0);
+        out[r + 1] = sse2_hsum_epi32(acc1);
+        out[r + 2] = sse2_hsum_epi32(acc2);
+        out[r + 3] = sse2_hsum_epi32(acc3);
+        for (; i < cnt; i++) {
+            out[r] += activations[i] * w0[i];
+            out[r + 1] += activations[i] * w1[i];
+            out[r + 2] += activations[i] * w2[i];
+            out[r + 3] += activations[i] * w3[i];
+        }
+    }
+
+    gemv_q8_scalar(rows - r, cnt, weights + r*stride, stride, activations, out + r);
+}
+
+TARGET_AVX2 static void gemv_q8_avx2(size_t rows, size_t cnt, const int8_t *weights, size_t stride, const uint8_t *activations, int32_t *out) {
+    size_t r = 0;
+    for (; r + 4 <= rows; r += 4) {
+        const int8_t *w0 = weights + r*stride, *w1 = w0 + stride, *w2 = w1 + stride, *w3 = w2 + stride;
+        __m256i acc0 = _mm256_setzero_si256(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+        size_t i = 0;
+        for (; i + 32 <= cnt; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *) (activations + i));
+            acc0 = _mm256_add_epi32(acc0, avx2_madd_q8(a, _mm256_loadu_si256((const __m256i *) (w0 + i))));
+            acc1 = _mm256_add_epi32(acc1, avx2_madd_q8(a, _mm256_loadu_si256((const __m256i *) (w1 + i))));
+            acc2 = _mm256_add_epi32(acc2, avx2_madd_q8(a, _mm256_loadu_si256((const __m256i *) (w2 + i))));
+            acc3 = _mm256_add_epi32(acc3, avx2_madd_q8(a, _mm256_loadu_si256((const __m256i *) (w3 + i))));
+        }
+
+        out[r] = avx2_hsum_epi32(acc0);
+        out[r + 1] = avx2_hsum_epi32(acc1);
+        out[r + 2] = avx2_hsum_epi32(acc2);
+        out[r + 3] = avx2_hsum_epi32(acc3);
+        for (; i < cnt; i++) {
+            out[r] += activations[i] * w0[i];
+            out[r + 1] += activations[i] * w1[i];
+            out[r + 2] += activations[i] * w2[i];
+            out[r + 3] += activations[i] * w3[i];
+        }
+    }
+
+    gemv_q8_scalar(rows - r, cnt, weights + r*stride, stride, activations, out + r);
+}
+
+// the same body for avx512bw and VNNI, tails are handled with masked loads
+#define GEMV_Q8_AVX512(name, target, madd)                                                                          \
+target static void name(size_t rows, size_t cnt, const int8_t *weights, size_t stride, const uint8_t *activations, int32_t *out) { \
+    size_t r = 0;                                                                                                   \
+    for (; r + 4 <= rows; r += 4) {                                                                                 \
+        const int8_t *w0 = weights + r*stride, *w1 = w0 + stride, *w2 = w1 + stride, *w3 = w2 + stride;             \
+        __m512i acc0 = _mm512_setzero_si512(), acc1 = acc0, acc2 = acc0, acc3 = acc0;                               \
+        for (size_t i = 0; i < cnt; i += 64) {                                                                      \
+            __mmask64 mask = avx512_tail_mask(cnt - i);                                                             \
+            __m512i a = _mm512_maskz_loadu_epi8(mask, activations + i);                                             \
+            acc0 = madd(acc0, a, _mm512_maskz_loadu_epi8(mask, w0 + i));                                            \
+            acc1 = madd(acc1, a, _mm512_maskz_loadu_epi8(mask, w1 + i));                                            \
+            acc2 = madd(acc2, a, _mm512_maskz_loadu_epi8(mask, w2 + i));                                            \
+            acc3 = madd(acc3, a, _mm512_maskz_loadu_epi8(mask, w3 + i));                                            \
+        }                                                                                                           \
+                                                                                                                    \
+        out[r] = _mm512_reduce_add_epi32(acc0);                                                                     \
+        out[r + 1] = _mm512_reduce_add_epi32(acc1);                                                                 \
+        out[r + 2] = _mm512_reduce_add_epi32(acc2);                                                                 \
+        out[r + 3] = _mm512_reduce_add_epi32(acc3);                                                                 \
+    }                                                                                                               \
+                                                                                                                    \
+    for (; r < rows; r++) {                                                                                         \
+        const int8_t *w0 = weights + r*stride;                                                                      \
+        __m512i acc = _mm512_setzero_si512();                                                                       \
+        for (size_t i = 0; i < cnt; i += 64) {                                                                      \
+            __mmask64 mask = avx512_tail_mask(cnt - i);                                                             \
+            acc = madd(acc, _mm512_maskz_loadu_epi8(mask, activations + i), _mm512_maskz_loadu_epi8(mask, w0 + i)); \
+        }                                                                                                           \
+                                                                                                                    \
+        out[r] = _mm512_reduce_add_epi32(acc);                                                                      \
+    }                                                                                                               \
+}
+
+GEMV_Q8_AVX512(gemv_q8_avx512, TARGET_AVX512BW, avx512_madd_q8)
+GEMV_Q8_AVX512(gemv_q8_vnni, TARGET_AVX512VNNI, vnni_madd_q8)
+
+#define KERNEL_SET(isa) {             \
+    .name = #isa,                     \
+    .dot = dot_##isa,                 \
+    .dot_u8 = dot_u8_##isa,           \
+    .axpy = axpy_##isa,               \
+    .axpy_u8 = axpy_u8_##isa,         \
+    .axpy_fused = axpy_fused_##isa,   \
+    .sigmoid = sigmoid_##isa,         \
+    .gemm_nt = gemm_nt_##isa,         \
+    .gemm_acc = gemm_acc_##isa,       \
+    .gemv_q8 = gemv_q8_##isa,         \
+    .topologies = topologies_##isa,   \
+}
+
+static const Kernels sse2_kernels = KERNEL_SET(sse2);
+static const Kernels avx2_kernels = KERNEL_SET(avx2);
+static const Kernels avx512_kernels = KERNEL_SET(avx512);
+#endif // __x86_64__
+
+__attribute__((constructor))
+void select_kernels(void) {
+    kernels = scalar_kernels;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    bool has_avx512 = has_avx2 && __builtin_cpu_supports("avx512f");
+
+    char *forced = getenv("RNA_KERNELS");
+    if (forced != NULL) {
+        if (strcmp(forced, "scalar") == 0) return;
+        if (strcmp(forced, "sse2") == 0) has_avx2 = has_avx512 = false;
+        if (strcmp(forced, "avx2") == 0) has_avx512 = false;
+    }
+
+    if (has_avx512) {
+        kernels = avx512_kernels;
+    } else if (has_avx2) {
+        kernels = avx2_kernels;
+    } else {
+        kernels = sse2_kernels; // part of the x86-64 baseline
+    }
+
+    // the int8 kernel needs more than avx512f, without it the avx2 one serves avx512 CPUs
+    if (has_avx512 && __builtin_cpu_supports("avx512bw")) {
+        kernels.gemv_q8 = __builtin_cpu_supports("avx512vnni") ? gemv_q8_vnni : gemv_q8_avx512;
+    } else if (has_avx512) {
+        kernels.gemv_q8 = gemv_q8_avx2;
+    }
+#endif
+}
@@ -0,0 +1,64 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "training.h"
+#include "topologies.h"
+
+// Pixels are fed to the first layer as bytes scaled by PIXEL_SCALE
+#define PIXEL_SCALE ((Real) (1.0/255.0))
+
+// Row stride of a layer with `cnt` inputs in the model arena, rows start 64-byte aligned
+#define TOPOLOGY_STRIDE(cnt) (((cnt) + 64/sizeof(Real) - 1) / (64/sizeof(Real)) * (64/sizeof(Real)))
+
+enum {
+#define TOPOLOGY(name, ...) TOPOLOGY_##name,
+    RNA_TOPOLOGIES
+#undef TOPOLOGY
+    TOPOLOGY_COUNT
+};
+
+// Passes of a whole model of one shape from topologies.h, with every count and stride a constant.
+// The first layer reads either a normalized `image` or raw `pixels`; with neither, `forward` expects
+// the layer 0 values to be set already and `backward` leaves the layer 0 weights to the caller
+typedef struct Topology_Kernels {
+    const char *name;
+    uint32_t inputs;
+    uint32_t neurons[TOPOLOGY_LAYERS];
+    void (*forward)(Real *const *weights, Real *const *biases, const Real *image, const uint8_t *pixels, Real *const *values);
+    // one SGD step after `forward`, returns the summed squared error of the outputs
+    double (*backward)(Real *const *weights, Real *const *biases, Real *const *values, Real *const *errors,
+                       const Real *image, const uint8_t *pixels, uint8_t label, Real lr);
+} Topology_Kernels;
+
+// Vector kernels used by the hot loops of training and inference. `kernels` points to the
+// fastest implementation the CPU supports, picked once at startup (see `select_kernels`)
+typedef struct {
+    const char *name;
+    Real (*dot)(const Real *a, const Real *b, size_t cnt);                 // sum(a*b)
+    Real (*dot_u8)(const Real *weights, const uint8_t *pixels, size_t cnt); // sum(weights*pixels), unscaled
+    void (*axpy)(Real *y, Real a, const Real *x, size_t cnt);              // y += a*x
+    void (*axpy_u8)(Real *y, Real a, const uint8_t *pixels, size_t cnt);   // y += a*pixels, unscaled
+    void (*axpy_fused)(Real *y, Real b, Real *w, Real a, const Real *x, size_t cnt); // y += b*w with w before w += a*x, one pass over w
+    void (*sigmoid)(Real *values, size_t cnt);                             // in place activation
+
+    // C = A * B^T, where A is m x k, B is n x k and C is m x n, all row major with the given row strides
+    void (*gemm_nt)(size_t m, size_t n, size_t k, const Real *a, size_t lda, const Real *b, size_t ldb, Real *c, size_t ldc);
+    // C += A * B, where A(i, p) = a[i*a_row + p*a_col] is m x k (pass swapped strides for A^T), B is k x n and C is m x n
+    void (*gemm_acc)(size_t m, size_t n, size_t k, const Real *a, size_t a_row, size_t a_col, const Real *b, size_t ldb, Real *c, size_t ldc);
+
+    // out[r] = sum(weights[r*stride + i] * activations[i]) over `cnt` values for every row of an int8
+    // quantized layer. Activations must be <= 127 so the pairwise 16 bit sums of pmaddubsw cannot saturate
+    void (*gemv_q8)(size_t rows, size_t cnt, const int8_t *weights, size_t stride, const uint8_t *activations, int32_t *out);
+
+    const Topology_Kernels *topologies; // TOPOLOGY_COUNT entries, NULL when only the generic passes exist
+} Kernels;
+
+extern Kernels kernels;
+
+// Set RNA_KERNELS=scalar|sse2|avx2|avx512 in the environment to force an implementation
+void select_kernels(void);
+
+#endif // KERNELS_H
@@ -0,0 +1,359 @@
+// Body of the SIMD kernels, included once per instruction set by kernels.c.
+// The includer defines TARGET, KERNEL(name) and the V_* vector operations over VEC (WIDTH lanes of Real)
+
+TARGET static Real KERNEL(dot)(const Real *a, const Real *b, size_t cnt) {
+    VEC acc0 = V_ZERO();
+    VEC acc1 = V_ZERO();
+    size_t i = 0;
+    for (; i + 2*WIDTH <= cnt; i += 2*WIDTH) {
+        acc0 = V_FMADD(V_LOADU(a + i), V_LOADU(b + i), acc0);
+        acc1 = V_FMADD(V_LOADU(a + i + WIDTH), V_LOADU(b + i + WIDTH), acc1);
+    }
+
+    for (; i + WIDTH <= cnt; i += WIDTH) {
+        acc0 = V_FMADD(V_LOADU(a + i), V_LOADU(b + i), acc0);
+    }
+
+    Real sum = V_HSUM(V_ADD(acc0, acc1));
+    for (; i < cnt; i++) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+TARGET static Real KERNEL(dot_u8)(const Real *weights, const uint8_t *pixels, size_t cnt) {
+    VEC acc0 = V_ZERO();
+    VEC acc1 = V_ZERO();
+    size_t i = 0;
+    for (; i + 2*WIDTH <= cnt; i += 2*WIDTH) {
+        acc0 = V_FMADD(V_LOADU(weights + i), V_LOAD_U8(pixels + i), acc0);
+        acc1 = V_FMADD(V_LOADU(weights + i + WIDTH), V_LOAD_U8(pixels + i + WIDTH), acc1);
+    }
+
+    for (; i + WIDTH <= cnt; i += WIDTH) {
+        acc0 = V_FMADD(V_LOADU(weights + i), V_LOAD_U8(pixels + i), acc0);
+    }
+
+    Real sum = V_HSUM(V_ADD(acc0, acc1));
+    for (; i < cnt; i++) {
+        sum += weights[i] * pixels[i];
+    }
+
+    return sum;
+}
+
+TARGET static void KERNEL(axpy)(Real *y, Real a, const Real *x, size_t cnt) {
+    VEC va = V_SET1(a);
+    size_t i = 0;
+    for (; i + WIDTH <= cnt; i += WIDTH) {
+        V_STOREU(y + i, V_FMADD(va, V_LOADU(x + i), V_LOADU(y + i)));
+    }
+
+    for (; i < cnt; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+// Backward step of one weight row: the error sums of the layer below take the row before its update
+TARGET static void KERNEL(axpy_fused)(Real *y, Real b, Real *w, Real a, const Real *x, size_t cnt) {
+    VEC vb = V_SET1(b);
+    VEC va = V_SET1(a);
+    size_t i = 0;
+    for (; i < cnt / WIDTH * WIDTH; i += WIDTH) {
+        VEC vw = V_LOADU(w + i);
+        V_STOREU(y + i, V_FMADD(vb, vw, V_LOADU(y + i)));
+        V_STOREU(w + i, V_FMADD(va, V_LOADU(x + i), vw));
+    }
+
+    for (; i < cnt; i++) {
+        y[i] += b * w[i];
+        w[i] += a * x[i];
+    }
+}
+
+TARGET static void KERNEL(axpy_u8)(Real *y, Real a, const uint8_t *pixels, size_t cnt) {
+    VEC va = V_SET1(a);
+    size_t i = 0;
+    for (; i + WIDTH <= cnt; i += WIDTH) {
+        V_STOREU(y + i, V_FMADD(va, V_LOAD_U8(pixels + i), V_LOADU(y + i)));
+    }
+
+    for (; i < cnt; i++) {
+        y[i] += a * pixels[i];
+    }
+}
+
+TARGET static void KERNEL(sigmoid)(Real *values, size_t cnt) {
+    VEC half = V_SET1((Real) .5);
+    VEC one = V_SET1(1);
+    size_t i = 0;
+    // bound written so GCC sees the tail below is short once `cnt` is a constant (topology kernels)
+    for (; i < cnt / WIDTH * WIDTH; i += WIDTH) {
+        VEC v = V_LOADU(values + i);
+        V_STOREU(values + i, V_MUL(half, V_ADD(V_DIV(v, V_ADD(one, V_ABS(v))), one)));
+    }
+
+    for (; i < cnt; i++) {
+        Real magnitude = values[i] < 0 ? -values[i] : values[i];
+        values[i] = (Real) .5 * (values[i] / (1 + magnitude) + 1);
+    }
+}
+
+// C[i][j] = sum_p A[i][p] * B[j][p] for an m x n block of C, A and B are row major with k columns.
+// Blocks of GEMM_NT_ROWS rows of B stay in cache while every group of 4 rows of A runs against them,
+// and each 4 x 2 tile of C keeps its accumulators in registers so every load feeds several FMAs
+TARGET static void KERNEL(gemm_nt)(size_t m, size_t n, size_t k, const Real *a, size_t lda, const Real *b, size_t ldb, Real *c, size_t ldc) {
+    for (size_t j0 = 0; j0 < n; j0 += GEMM_NT_ROWS) {
+        size_t j_end = j0 + GEMM_NT_ROWS < n ? j0 + GEMM_NT_ROWS : n;
+        for (size_t i = 0; i < m; i += 4) {
+            size_t j = j0;
+            for (; i + 4 <= m && j + 2 <= j_end; j += 2) {
+                const Real *a0 = a + i*lda, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+                const Real *b0 = b + j*ldb, *b1 = b0 + ldb;
+                VEC c00 = V_ZERO(), c01 = V_ZERO(), c10 = V_ZERO(), c11 = V_ZERO();
+                VEC c20 = V_ZERO(), c21 = V_ZERO(), c30 = V_ZERO(), c31 = V_ZERO();
+                size_t p = 0;
+                for (; p + WIDTH <= k; p += WIDTH) {
+                    VEC vb0 = V_LOADU(b0 + p);
+                    VEC vb1 = V_LOADU(b1 + p);
+                    VEC va = V_LOADU(a0 + p);
+                    c00 = V_FMADD(va, vb0, c00);
+                    c01 = V_FMADD(va, vb1, c01);
+                    va = V_LOADU(a1 + p);
+                    c10 = V_FMADD(va, vb0, c10);
+                    c11 = V_FMADD(va, vb1, c11);
+                    va = V_LOADU(a2 + p);
+                    c20 = V_FMADD(va, vb0, c20);
+                    c21 = V_FMADD(va, vb1, c21);
+                    va = V_LOADU(a3 + p);
+                    c30 = V_FMADD(va, vb0, c30);
+                    c31 = V_FMADD(va, vb1, c31);
+                }
+
+                Real sums[4][2] = {
+                    { V_HSUM(c00), V_HSUM(c01) }, { V_HSUM(c10), V_HSUM(c11) },
+                    { V_HSUM(c20), V_HSUM(c21) }, { V_HSUM(c30), V_HSUM(c31) },
+                };
+                const Real *rows[4] = { a0, a1, a2, a3 };
+                for (size_t r = 0; r < 4; r++) {
+                    for (size_t q = p; q < k; q++) {
+                        sums[r][0] += rows[r][q] * b0[q];
+                        sums[r][1] += rows[r][q] * b1[q];
+                    }
+
+                    c[(i + r)*ldc + j] = sums[r][0];
+                    c[(i + r)*ldc + j + 1] = sums[r][1];
+                }
+            }
+
+            // edges that do not fill a whole tile
+            for (size_t ii = i; ii < i + 4 && ii < m; ii++) {
+                for (size_t jj = j; jj < j_end; jj++) {
+                    c[ii*ldc + jj] = KERNEL(dot)(a + ii*lda, b + jj*ldb, k);
+                }
+            }
+        }
+    }
+}
+
+// C[i][j] += sum_p A(i, p) * B[p][j] for an m x n block of C, where A(i, p) = a[i*a_row + p*a_col]
+// so the same kernel serves A and A transposed. Columns of B are walked in GEMM_ACC_COLS wide blocks
+// that stay in cache for all rows of C, each tile of 4 rows keeps its accumulators in registers
+TARGET static void KERNEL(gemm_acc)(size_t m, size_t n, size_t k, const Real *a, size_t a_row, size_t a_col, const Real *b, size_t ldb, Real *c, size_t ldc) {
+    for (size_t j0 = 0; j0 < n; j0 += GEMM_ACC_COLS) {
+        size_t j_end = j0 + GEMM_ACC_COLS < n ? j0 + GEMM_ACC_COLS : n;
+        size_t i = 0;
+        for (; i + 4 <= m; i += 4) {
+            const Real *ar0 = a + i*a_row, *ar1 = ar0 + a_row, *ar2 = ar1 + a_row, *ar3 = ar2 + a_row;
+            Real *cr0 = c + i*ldc, *cr1 = cr0 + ldc, *cr2 = cr1 + ldc, *cr3 = cr2 + ldc;
+            size_t j = j0;
+            for (; j + WIDTH <= j_end; j += WIDTH) {
+                VEC c0 = V_LOADU(cr0 + j), c1 = V_LOADU(cr1 + j), c2 = V_LOADU(cr2 + j), c3 = V_LOADU(cr3 + j);
+                for (size_t p = 0; p < k; p++) {
+                    VEC vb = V_LOADU(b + p*ldb + j);
+                    c0 = V_FMADD(V_SET1(ar0[p*a_col]), vb, c0);
+                    c1 = V_FMADD(V_SET1(ar1[p*a_col]), vb, c1);
+                    c2 = V_FMADD(V_SET1(ar2[p*a_col]), vb, c2);
+                    c3 = V_FMADD(V_SET1(ar3[p*a_col]), vb, c3);
+                }
+
+                V_STOREU(cr0 + j, c0);
+                V_STOREU(cr1 + j, c1);
+                V_STOREU(cr2 + j, c2);
+                V_STOREU(cr3 + j, c3);
+            }
+
+            for (; j < j_end; j++) {
+                for (size_t p = 0; p < k; p++) {
+                    Real vb = b[p*ldb + j];
+                    cr0[j] += ar0[p*a_col] * vb;
+                    cr1[j] += ar1[p*a_col] * vb;
+                    cr2[j] += ar2[p*a_col] * vb;
+                    cr3[j] += ar3[p*a_col] * vb;
+                }
+            }
+        }
+
+        for (; i < m; i++) {
+            for (size_t p = 0; p < k; p++) {
+                KERNEL(axpy)(c + i*ldc + j0, a[i*a_row + p*a_col], b + p*ldb + j0, j_end - j0);
+            }
+        }
+    }
+}
+
+// Whole-model passes for the shapes of topologies.h. The helpers are generic over the layer sizes,
+// every TOPOLOGY entry below instantiates them with constants and `flatten` inlines the vector kernels
+// into it: loop bounds and row strides fold, the scalar tails vanish and the short loops of the small
+// layers unroll. The backward pass does the same operations as `backpropagate` in training.c, the
+// forward pass only sums each row in another order
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Rows run 4 at a time so every input load feeds 4 accumulators. With `pixels` the inputs are the
+// raw bytes of the image and the sums are scaled afterwards, as in `dot_u8`
+TARGET static ALWAYS_INLINE void KERNEL(topology_layer)(const Real *weights, const Real *biases, const Real *in, const uint8_t *pixels, size_t in_cnt,
+                                                        Real *out, size_t cnt) {
+    const size_t stride = TOPOLOGY_STRIDE(in_cnt);
+    const Real scale = pixels != NULL ? PIXEL_SCALE : 1;
+    size_t n = 0;
+    for (; n < cnt / 4 * 4; n += 4) {
+        const Real *w0 = weights + n*stride, *w1 = w0 + stride, *w2 = w1 + stride, *w3 = w2 + stride;
+        VEC acc0 = V_ZERO(), acc1 = V_ZERO(), acc2 = V_ZERO(), acc3 = V_ZERO();
+        size_t p = 0;
+        for (; p < in_cnt / WIDTH * WIDTH; p += WIDTH) {
+            VEC v = pixels != NULL ? V_LOAD_U8(pixels + p) : V_LOADU(in + p);
+            acc0 = V_FMADD(V_LOADU(w0 + p), v, acc0);
+            acc1 = V_FMADD(V_LOADU(w1 + p), v, acc1);
+            acc2 = V_FMADD(V_LOADU(w2 + p), v, acc2);
+            acc3 = V_FMADD(V_LOADU(w3 + p), v, acc3);
+        }
+
+        Real sums[4] = { V_HSUM(acc0), V_HSUM(acc1), V_HSUM(acc2), V_HSUM(acc3) };
+        for (; p < in_cnt; p++) {
+            Real v = pixels != NULL ? pixels[p] : in[p];
+            sums[0] += w0[p] * v;
+            sums[1] += w1[p] * v;
+            sums[2] += w2[p] * v;
+            sums[3] += w3[p] * v;
+        }
+
+        for (size_t r = 0; r < 4; r++) {
+            out[n + r] = sums[r] * scale + biases[n + r];
+        }
+    }
+
+    for (; n < cnt; n++) {
+        Real sum = pixels != NULL ? KERNEL(dot_u8)(weights + n*stride, pixels, in_cnt) : KERNEL(dot)(weights + n*stride, in, in_cnt);
+        out[n] = sum * scale + biases[n];
+    }
+
+    KERNEL(sigmoid)(out, cnt);
+}
+
+TARGET static ALWAYS_INLINE void KERNEL(topology_forward)(Real *const *weights, Real *const *biases, const Real *image, const uint8_t *pixels, Real *const *values,
+                                                          size_t inputs, size_t n0, size_t n1, size_t n2) {
+    // separate calls so each inlined copy has a constant NULL in place of the other input
+    if (pixels != NULL) {
+        KERNEL(topology_layer)(weights[0], biases[0], NULL, pixels, inputs, values[0], n0);
+    } else if (image != NULL) {
+        KERNEL(topology_layer)(weights[0], biases[0], image, NULL, inputs, values[0], n0);
+    }
+
+    KERNEL(topology_layer)(weights[1], biases[1], values[0], NULL, n0, values[1], n1);
+    KERNEL(topology_layer)(weights[2], biases[2], values[1], NULL, n1, values[2], n2);
+}
+
+// Sweeps the rows of a layer with errors already set: each row adds to the error sums of the layer
+// below (`in_errors`, NULL for the first layer) before taking its own update from `in` or `pixels`
+// (neither = rows left alone), so every row is read once
+TARGET static ALWAYS_INLINE void KERNEL(topology_update)(Real *weights, Real *biases, const Real *errors, size_t cnt,
+                                                         const Real *in, const uint8_t *pixels, Real *in_errors, size_t in_cnt, Real lr) {
+    if (in_errors != NULL) {
+        memset(in_errors, 0, sizeof(*in_errors) * in_cnt);
+    }
+
+    for (size_t n = 0; n < cnt; n++) {
+        Real *row = weights + n*TOPOLOGY_STRIDE(in_cnt);
+        Real scale = lr * errors[n];
+        if (in_errors != NULL) {
+            KERNEL(axpy_fused)(in_errors, errors[n], row, scale, in, in_cnt);
+        } else if (pixels != NULL) {
+            KERNEL(axpy_u8)(row, scale * PIXEL_SCALE, pixels, in_cnt);
+        } else if (in != NULL) {
+            KERNEL(axpy)(row, scale, in, in_cnt);
+        }
+
+        biases[n] += scale;
+    }
+}
+
+// Turns the error sums of a hidden layer into its errors
+TARGET static ALWAYS_INLINE void KERNEL(topology_errors)(const Real *values, Real *errors, size_t cnt) {
+    for (size_t n = 0; n < cnt; n++) {
+        Real y = values[n];
+        errors[n] = errors[n] * y * (1 - y);
+    }
+}
+
+TARGET static ALWAYS_INLINE double KERNEL(topology_backward)(Real *const *weights, Real *const *biases, Real *const *values, Real *const *errors,
+                                                             const Real *image, const uint8_t *pixels, uint8_t label, Real lr,
+                                                             size_t inputs, size_t n0, size_t n1, size_t n2) {
+    double local_error = 0.;
+    for (size_t n = 0; n < n2; n++) {
+        Real desired = n == label ? 1 : 0;
+        Real y = values[2][n];
+        errors[2][n] = (desired - y) * y * (1 - y);
+        local_error += (desired - y) * (desired - y);
+    }
+
+    KERNEL(topology_update)(weights[2], biases[2], errors[2], n2, values[1], NULL, errors[1], n1, lr);
+    KERNEL(topology_errors)(values[1], errors[1], n1);
+    KERNEL(topology_update)(weights[1], biases[1], errors[1], n1, values[0], NULL, errors[0], n0, lr);
+    KERNEL(topology_errors)(values[0], errors[0], n0);
+    if (pixels != NULL) {
+        KERNEL(topology_update)(weights[0], biases[0], errors[0], n0, NULL, pixels, NULL, inputs, lr);
+    } else {
+        KERNEL(topology_update)(weights[0], biases[0], errors[0], n0, image, NULL, NULL, inputs, lr);
+    }
+
+    return local_error;
+}
+
+#define TOPOLOGY(name, inputs, n0, n1, n2)                                                                                  \
+TARGET __attribute__((flatten)) static void KERNEL(forward_##name)(Real *const *weights, Real *const *biases,             \
+                                                                   const Real *image, const uint8_t *pixels, Real *const *values) { \
+    KERNEL(topology_forward)(weights, biases, image, pixels, values, inputs, n0, n1, n2);                                  \
+}                                                                                                                       \
+                                                                                                                        \
+TARGET __attribute__((flatten)) static double KERNEL(backward_##name)(Real *const *weights, Real *const *biases,          \
+                                                                      Real *const *values, Real *const *errors,           \
+                                                                      const Real *image, const uint8_t *pixels, uint8_t label, Real lr) { \
+    return KERNEL(topology_backward)(weights, biases, values, errors, image, pixels, label, lr, inputs, n0, n1, n2);        \
+}
+RNA_TOPOLOGIES
+#undef TOPOLOGY
+
+static const Topology_Kernels KERNEL(topologies)[TOPOLOGY_COUNT] = {
+#define TOPOLOGY(name, inputs, n0, n1, n2) { #name, inputs, { n0, n1, n2 }, KERNEL(forward_##name), KERNEL(backward_##name) },
+    RNA_TOPOLOGIES
+#undef TOPOLOGY
+};
+
+#undef ALWAYS_INLINE
+#undef TARGET
+#undef KERNEL
+#undef VEC
+#undef WIDTH
+#undef V_ZERO
+#undef V_SET1
+#undef V_LOADU
+#undef V_STOREU
+#undef V_LOAD_U8
+#undef V_ADD
+#undef V_MUL
+#undef V_DIV
+#undef V_FMADD
+#undef V_ABS
+#undef V_HSUM
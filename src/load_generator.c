@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "training.h"
+#include "inference_protocol.h"
+
+#define MAX_CONNECTIONS 1024
+
+typedef struct {
+    const char *socket_path;
+    Data *images;
+    size_t first;              // image the connection starts at, it walks the test set from there
+    size_t requests;
+    double *latencies;         // seconds, one per request
+    size_t correct;
+    bool ok;
+} Client;
+
+double now_secs(void) {
+    struct timespec now;
+    assert(clock_gettime(CLOCK_MONOTONIC, &now) >= 0);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+bool read_all(int fd, void *buffer, size_t size) {
+    for (size_t done = 0; done < size;) {
+        ssize_t n = read(fd, (uint8_t *) buffer + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+
+    return true;
+}
+
+bool write_all(int fd, const void *buffer, size_t size) {
+    for (size_t done = 0; done < size;) {
+        ssize_t n = write(fd, (const uint8_t *) buffer + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+
+    return true;
+}
+
+// One connection sending a request, waiting for its label and sending the next one
+void *run_client(void *args) {
+    Client *client = (Client *) args;
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    strncpy(address.sun_path, client->socket_path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        fprintf(stderr, "ERROR: cannot connect to %s: %s\n", client->socket_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    Data *images = client->images;
+    for (size_t i = 0; i < client->requests; i++) {
+        size_t index = (client->first + i) % images->meta.size;
+        uint8_t label;
+        double start = now_secs();
+        if (!write_all(fd, images->pixels + index*images->stride, INFERENCE_IMAGE_SIZE) || !read_all(fd, &label, sizeof(label))) {
+            fprintf(stderr, "ERROR: connection to %s closed after %zu requests\n", client->socket_path, i);
+            close(fd);
+            return NULL;
+        }
+
+        client->latencies[i] = now_secs() - start;
+        if (label == images->labels[index]) client->correct++;
+    }
+
+    client->ok = true;
+    close(fd);
+    return NULL;
+}
+
+char* shift(int *argc, char ***argv) {
+    return (*argc)--, *(*argv)++;
+}
+
+void usage(char *program_name) {
+    printf(
+"Usage:\n"
+"  %s [--socket <path>] [--connections <n>] [--requests <n>]\n"
+"  %s --help\n",
+    program_name, program_name);
+
+    printf(
+"\nLoad generator for the inference server: every connection sends test images one at a time and\n"
+"waits for each label. Reports throughput, p50/p99 round trip latency and accuracy.\n"
+"\nOptions:\n"
+"  --help               Prints this message.\n"
+"  --socket <path>      Socket of the server [default: " INFERENCE_DEFAULT_SOCKET "].\n"
+"  --connections <n>    Concurrent connections [default: 32].\n"
+"  --requests <n>       Requests per connection [default: 1000].\n");
+}
+
+int main(int argc, char **argv) {
+    char *program_name = shift(&argc, &argv);
+    char *socket_path = INFERENCE_DEFAULT_SOCKET;
+    uint32_t connections = 32;
+    size_t requests = 1000;
+    while (argc > 0) {
+        char *parameter = shift(&argc, &argv);
+        if (strcmp(parameter, "--help") == 0) {
+            usage(program_name);
+            return 0;
+        }
+
+        if (argc == 0) {
+            fprintf(stderr, "ERROR: missing parameter '%s' value\n", parameter);
+            usage(program_name);
+            return 1;
+        }
+
+        char *value = shift(&argc, &argv);
+        if (strcmp(parameter, "--socket") == 0) {
+            socket_path = value;
+        } else if (strcmp(parameter, "--connections") == 0) {
+            connections = atoi(value);
+        } else if (strcmp(parameter, "--requests") == 0) {
+            requests = atoi(value);
+        } else {
+            fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
+        }
+    }
+
+    if (connections == 0) connections = 1;
+    if (connections > MAX_CONNECTIONS) connections = MAX_CONNECTIONS;
+
+    Data images = {0};
+    if (!map_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &images)) {
+        return 1;
+    }
+
+    if (images.meta.rows*images.meta.cols != INFERENCE_IMAGE_SIZE) {
+        fprintf(stderr, "ERROR: test images are %ux%u, expected %dx%d\n", images.meta.rows, images.meta.cols, INFERENCE_IMAGE_ROWS, INFERENCE_IMAGE_COLS);
+        return 1;
+    }
+
+    double *latencies = malloc(sizeof(*latencies) * connections * requests);
+    assert(latencies != NULL);
+    static Client clients[MAX_CONNECTIONS];
+    static pthread_t handles[MAX_CONNECTIONS];
+
+    double start = now_secs();
+    for (uint32_t i = 0; i < connections; i++) {
+        clients[i] = (Client) {
+            .socket_path = socket_path,
+            .images = &images,
+            .first = i*requests,
+            .requests = requests,
+            .latencies = latencies + i*requests,
+        };
+        pthread_create(&handles[i], NULL, run_client, (void *) &clients[i]);
+    }
+
+    size_t served = 0, correct = 0;
+    for (uint32_t i = 0; i < connections; i++) {
+        pthread_join(handles[i], NULL);
+        if (clients[i].ok) {
+            // keep the latencies of the connections that finished packed at the start
+            memmove(latencies + served, clients[i].latencies, sizeof(*latencies) * requests);
+            served += requests;
+            correct += clients[i].correct;
+        }
+    }
+    double secs = now_secs() - start;
+
+    if (served == 0) {
+        fprintf(stderr, "ERROR: no connection finished\n");
+        return 1;
+    }
+
+    qsort(latencies, served, sizeof(*latencies), compare_doubles);
+    printf("+-----------------------------------+\n");
+    printf("| Load Generator                    |\n");
+    printf("+--------------------+--------------+\n");
+    printf("| Connections        | %12u |\n", connections);
+    printf("| Requests           | %12zu |\n", served);
+    printf("| Requests/s         | %12.0f |\n", served/secs);
+    printf("| Latency p50 ms     | %12.3f |\n", latencies[served/2]*1e3);
+    printf("| Latency p99 ms     | %12.3f |\n", latencies[served*99/100]*1e3);
+    printf("| Accuracy           | %11.2f%% |\n", correct*100.0/served);
+    printf("+--------------------+--------------+\n");
+
+    free(latencies);
+    denit_data(&images);
+    return served == (size_t) connections*requests ? 0 : 1;
+}
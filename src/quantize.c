@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "training.h"
+#include "kernels.h"
+
+double now_secs(void) {
+    struct timespec now;
+    assert(clock_gettime(CLOCK_MONOTONIC, &now) >= 0);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+long file_size(char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long) st.st_size : -1;
+}
+
+char* shift(int *argc, char ***argv) {
+    return (*argc)--, *(*argv)++;
+}
+
+void usage(char *program_name) {
+    printf(
+"Usage:\n"
+"  %s --model <model-file> --out <output-file>\n"
+"  %s --help\n",
+    program_name, program_name);
+
+    printf(
+"\nQuantizes a trained model to int8 weights with one scale per row and compares it with the\n"
+"original on the test data: file size, accuracy and per-image latency of `find_label`.\n"
+"\nOptions:\n"
+"  --help               Prints this message.\n"
+"  --model <file>       Model to quantize (JRNA v1 or v2).\n"
+"  --out <file>         Output file for the quantized model.\n");
+}
+
+int main(int argc, char **argv) {
+    char *program_name = shift(&argc, &argv);
+    char *model_path = NULL;
+    char *out_path = NULL;
+    while (argc > 0) {
+        char *parameter = shift(&argc, &argv);
+        if (strcmp(parameter, "--help") == 0) {
+            usage(program_name);
+            return 0;
+        }
+
+        if (argc == 0) {
+            fprintf(stderr, "ERROR: missing parameter '%s' value\n", parameter);
+            usage(program_name);
+            return 1;
+        }
+
+        char *value = shift(&argc, &argv);
+        if (strcmp(parameter, "--model") == 0) {
+            model_path = value;
+        } else if (strcmp(parameter, "--out") == 0) {
+            out_path = value;
+        } else {
+            fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
+        }
+    }
+
+    if (model_path == NULL || out_path == NULL) {
+        usage(program_name);
+        return 1;
+    }
+
+    RNA_Model model = {0};
+    if (!load_model(model_path, &model)) {
+        return 1;
+    }
+
+    Quantized_Model quantized = {0};
+    quantize_model(&model, &quantized);
+    if (!save_quantized_model(&quantized, out_path)) {
+        fprintf(stderr, "ERROR: failed to save quantized model\n");
+        return 1;
+    }
+
+    // everything below runs on the model read back from the file
+    denit_quantized_model(&quantized);
+    if (!load_quantized_model(out_path, &quantized)) {
+        return 1;
+    }
+
+    printf("INFO: saved quantized model to file %s\n", out_path);
+
+    Data images = {0};
+    if (!map_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &images)) {
+        return 1;
+    }
+
+    if (model.weights_cnt[0] != images.meta.rows*images.meta.cols) {
+        fprintf(stderr, "ERROR: model expects %u inputs, test images have %u\n", model.weights_cnt[0], images.meta.rows*images.meta.cols);
+        return 1;
+    }
+
+    size_t correct = 0, correct_q8 = 0, agree = 0;
+    double start = now_secs();
+    for (size_t i = 0; i < images.meta.size; i++) {
+        correct += find_label_at(&model, &images, i) == images.labels[i];
+    }
+    double secs = now_secs() - start;
+
+    start = now_secs();
+    for (size_t i = 0; i < images.meta.size; i++) {
+        correct_q8 += find_label_quantized(&quantized, images.pixels + i*images.stride) == images.labels[i];
+    }
+    double secs_q8 = now_secs() - start;
+
+    for (size_t i = 0; i < images.meta.size; i++) {
+        agree += find_label_at(&model, &images, i) == find_label_quantized(&quantized, images.pixels + i*images.stride);
+    }
+
+    size_t n = images.meta.size;
+    printf("+----------------------------------------------+\n");
+    char title[64];
+    snprintf(title, sizeof(title), "Quantization, %s kernels", kernels.name);
+    printf("| %-44s |\n", title);
+    printf("+--------------------+------------+------------+\n");
+    printf("|                    | %10s |       int8 |\n", sizeof(Real) == sizeof(double) ? "float64" : "float32");
+    printf("+--------------------+------------+------------+\n");
+    printf("| File bytes         | %10ld | %10ld |\n", file_size(model_path), file_size(out_path));
+    printf("| Accuracy           | %9.2f%% | %9.2f%% |\n", correct*100.0/n, correct_q8*100.0/n);
+    printf("| Latency us/image   | %10.3f | %10.3f |\n", secs*1e6/n, secs_q8*1e6/n);
+    printf("| Same label         |            | %9.2f%% |\n", agree*100.0/n);
+    printf("+--------------------+------------+------------+\n");
+
+    denit_data(&images);
+    denit_quantized_model(&quantized);
+    denit_model(&model);
+    return 0;
+}
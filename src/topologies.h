@@ -0,0 +1,14 @@
+#ifndef TOPOLOGIES_H
+#define TOPOLOGIES_H
+
+// Model shapes that get forward and backward passes unrolled at compile time (see the end of
+// kernels_template.h). A model whose inputs and layer sizes match an entry runs on it, any other
+// shape on the generic loops of training.c.
+// TOPOLOGY(name, inputs, layer 0 neurons, layer 1 neurons, output neurons)
+#define RNA_TOPOLOGIES                       \
+    TOPOLOGY(mnist_64_32_10, 784, 64, 32, 10) \
+    TOPOLOGY(mnist_128_64_10, 784, 128, 64, 10)
+
+#define TOPOLOGY_LAYERS 3
+
+#endif // TOPOLOGIES_H
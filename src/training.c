@@ -1,4 +1,5 @@
 #include "training.h"
+#include "kernels.h"
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
@@ -7,9 +8,15 @@
 #include <string.h>
 
 #include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define ARR_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
 #define ERROR_VALIDATION_STEP 10000 // check error sum each ERROR_VALIDATION_STEP iterations
+#define TIMING_SAMPLE_STEP 16 // online SGD times one sample in TIMING_SAMPLE_STEP
 #define LOG_WRITE_ERROR(file) fprintf(stderr, "ERROR: could not write to file %s\n", file)
 #define LOG_READ_ERROR(msg, file) fprintf(stderr, "ERROR: could not read %s from file %s\n", msg, file)
 #define internal static
@@ -17,7 +24,10 @@
 static RNA_Parameters default_parameters = {
     .lr = 0.5,
     .tolerance = 0.02,
-    .max_iters = 50
+    .max_iters = 50,
+    .batch_size = 1,
+    .threads = 1,
+    .sync = false
 };
 
 RNA_Parameters get_default_parameters(void) {
@@ -108,6 +118,19 @@ internal bool read_parameters_from_file(char *file, RNA_Parameters *out) {
             out->lr = atof(value_buffer);
         } else if (strcmp(parameter_buffer, "TOLERANCE") == 0) {
             out->tolerance = atof(value_buffer);
+        } else if (strcmp(parameter_buffer, "BATCH_SIZE") == 0) {
+            out->batch_size = atoi(value_buffer);
+        } else if (strcmp(parameter_buffer, "THREADS") == 0) {
+            out->threads = atoi(value_buffer);
+        } else if (strcmp(parameter_buffer, "SYNC") == 0) {
+            out->sync = atoi(value_buffer) != 0;
+        } else if (strcmp(parameter_buffer, "CHECKPOINT_EVERY") == 0) {
+            out->checkpoint_every = strtoull(value_buffer, NULL, 10);
+        } else if (strcmp(parameter_buffer, "CHECKPOINT") == 0) {
+            // the file is read again before every run, the path of the previous read is ours to free
+            static char *config_checkpoint_path = NULL;
+            free(config_checkpoint_path);
+            out->checkpoint_path = config_checkpoint_path = strdup(value_buffer);
         } else if (strcmp(parameter_buffer, "OUT_DIR") == 0) {
             out->output_dir_path = value_buffer;
         } else {
@@ -120,7 +143,101 @@ internal bool read_parameters_from_file(char *file, RNA_Parameters *out) {
     return true;
 }
 
-bool read_data(const char *images_file_path, const char *labels_file_path, Data *data) {
+internal bool pread_all(int fd, void *buffer, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buffer, size, offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+
+        buffer = (char *) buffer + n;
+        size -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+internal double now_secs(void) {
+    struct timespec now;
+    assert(clock_gettime(CLOCK_MONOTONIC, &now) >= 0);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+#define DECODE_BLOCK_SIZE (64*1024) // pixels read per pread by each decode worker
+#define MAX_LOADER_THREADS 256
+
+typedef struct {
+    int fd;
+    off_t offset;              // file offset of the first pixel of the range
+    uint8_t *pixels;
+    Real *images;
+    size_t count;
+    bool ok;
+} Decode_Args;
+
+internal void *_decode_worker(void *args) {
+    Decode_Args *da = (Decode_Args *) args;
+    da->pixels = malloc(DECODE_BLOCK_SIZE);
+    assert(da->pixels != NULL);
+
+    da->ok = true;
+    for (size_t done = 0; da->ok && done < da->count; done += DECODE_BLOCK_SIZE) {
+        size_t cnt = da->count - done < DECODE_BLOCK_SIZE ? da->count - done : DECODE_BLOCK_SIZE;
+        da->ok = pread_all(da->fd, da->pixels, cnt, da->offset + done);
+
+        // plain loop so the compiler vectorizes the widening and the division
+        Real *images = da->images + done;
+        uint8_t *pixels = da->pixels;
+        for (size_t i = 0; i < cnt; i++) {
+            images[i] = pixels[i] / 255.0;
+        }
+    }
+
+    free(da->pixels);
+    return NULL;
+}
+
+// Reads and normalizes `total_pixels` pixels starting at `offset`, split across `threads` workers
+internal bool decode_pixels(int fd, off_t offset, Real *images, size_t total_pixels, uint32_t threads) {
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? cores : 1;
+    }
+
+    if (threads > MAX_LOADER_THREADS) {
+        threads = MAX_LOADER_THREADS;
+    }
+
+    if (threads > total_pixels / DECODE_BLOCK_SIZE) {
+        threads = total_pixels / DECODE_BLOCK_SIZE + 1;
+    }
+
+    pthread_t handles[threads];
+    Decode_Args args[threads];
+    size_t per_thread = total_pixels / threads;
+    for (uint32_t t = 0; t < threads; t++) {
+        size_t start = t*per_thread;
+        args[t] = (Decode_Args) {
+            .fd = fd,
+            .offset = offset + start,
+            .images = images + start,
+            .count = t == threads - 1 ? total_pixels - start : per_thread,
+        };
+        pthread_create(&handles[t], NULL, _decode_worker, (void *) &args[t]);
+    }
+
+    bool ok = true;
+    for (uint32_t t = 0; t < threads; t++) {
+        pthread_join(handles[t], NULL);
+        ok = ok && args[t].ok;
+    }
+
+    return ok;
+}
+
+internal bool decode_data(const char *images_file_path, const char *labels_file_path, Data *data) {
     FILE *labels_file = fopen(labels_file_path, "rb");
     FILE *images_file = fopen(images_file_path, "rb");
     if (images_file == NULL) {
@@ -142,23 +259,16 @@ bool read_data(const char *images_file_path, const char *labels_file_path, Data
     data->meta.size = big2lit(metadata_buffer + 4);
     data->meta.rows = big2lit(metadata_buffer + 8);
     data->meta.cols = big2lit(metadata_buffer + 12);
+    data->stride = data->meta.rows * data->meta.cols;
 
-    size_t total_pixels = data->meta.size * data->meta.rows * data->meta.cols;
-    uint8_t *images = malloc(total_pixels * sizeof(*images));
-    assert(images != NULL);
-    if (fread(images, data->meta.rows*data->meta.cols, data->meta.size, images_file) != data->meta.size) {
-        fprintf(stderr, "ERROR: cannot read all images from file %s\n", images_file_path);
-        goto ERROR;
-    }
-
+    size_t total_pixels = (size_t) data->meta.size * data->meta.rows * data->meta.cols;
     data->_images = malloc(total_pixels * sizeof(*data->_images));
     assert(data->_images != NULL);
-    for (size_t i = 0; i < total_pixels; i++) {
-        data->_images[i] = images[i] / 255.0;
+    if (!decode_pixels(fileno(images_file), sizeof(metadata_buffer), data->_images, total_pixels, data->loader_threads)) {
+        fprintf(stderr, "ERROR: cannot read all images from file %s\n", images_file_path);
+        goto ERROR;
     }
 
-    free(images);
-
     if (labels_file == NULL) {
         fprintf(stderr, "ERROR: cannot open file %s\n", labels_file_path);
         goto ERROR;
@@ -197,415 +307,2908 @@ ERROR:
     return false;
 }
 
-internal double sigmoid(double sum) {
-    return .5 * (sum / (1 + fabs(sum)) + 1);
-}
-
-internal double dot_product(double *a, double *b, size_t cnt) {
-    double sum = 0;
+internal void *map_file(const char *file_path, size_t *size) {
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: cannot open file '%s': %s\n", file_path, strerror(errno));
+        return NULL;
+    }
 
-    for (size_t i = 0; i + 3 < cnt; i += 4) {
-        sum += a[i]   * b[i]
-             + a[i+1] * b[i+1]
-             + a[i+2] * b[i+2]
-             + a[i+3] * b[i+3];
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "ERROR: cannot stat file '%s': %s\n", file_path, strerror(errno));
+        close(fd);
+        return NULL;
     }
 
-    size_t remaning = cnt % 4;
-    for (size_t i = 0; i < remaning; i++) {
-        sum += a[cnt - 1 - i] * b[cnt - 1 - i];
+    void *content = NULL;
+    if (st.st_size > 0) {
+        content = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (content == MAP_FAILED) {
+            fprintf(stderr, "ERROR: cannot map file '%s': %s\n", file_path, strerror(errno));
+            content = NULL;
+        }
+    } else {
+        fprintf(stderr, "ERROR: file '%s' is empty\n", file_path);
     }
 
-    return sum;
+    close(fd); // the mapping keeps its own reference to the file
+    *size = st.st_size;
+    return content;
 }
 
-internal double sum_weights(double *weights, double *values, size_t cnt) {
-    double sum = dot_product(weights, values, cnt);
-    sum += weights[cnt]; // bias
-    return sum;
-}
+bool map_data(const char *images_file_path, const char *labels_file_path, Data *data) {
+    double start = now_secs();
+    data->_mapped.images = map_file(images_file_path, &data->_mapped.images_size);
+    if (data->_mapped.images == NULL) {
+        goto ERROR;
+    }
 
-internal double *get_neuron_weights(RNA_Model *model, uint32_t layer, uint32_t neuron) {
-    return model->weights[layer] + neuron*(model->weights_cnt[layer] + 1);
-}
+    unsigned char *images = data->_mapped.images;
+    if (data->_mapped.images_size < 16 || big2lit(images) != 2051) {
+        fprintf(stderr, "ERROR: data file '%s' dont have correct magic number\n", images_file_path);
+        goto ERROR;
+    }
 
-int find_label(RNA_Model *model, double *image) {
-    double *values = image;
-    for (size_t layer = 0; layer < model->layer_count; layer++) {
-        for (size_t neuron = 0; neuron < model->neuron_cnt[layer]; neuron++) {
-            double sum = sum_weights(
-                get_neuron_weights(model, layer, neuron),
-                values,
-                model->weights_cnt[layer]
-            );
-            model->values[layer][neuron] = sigmoid(sum);
-        }
+    data->meta.size = big2lit(images + 4);
+    data->meta.rows = big2lit(images + 8);
+    data->meta.cols = big2lit(images + 12);
+    data->stride = data->meta.rows * data->meta.cols;
 
-        values = model->values[layer];
+    size_t total_pixels = (size_t) data->meta.size * data->meta.rows * data->meta.cols;
+    if (data->_mapped.images_size < 16 + total_pixels) {
+        fprintf(stderr, "ERROR: cannot read all images from file %s\n", images_file_path);
+        goto ERROR;
     }
 
-    int label = 0;
-    for (size_t out_neuron = 1; out_neuron < model->neuron_cnt[model->layer_count - 1]; out_neuron++) {
-        if (model->values[model->layer_count - 1][out_neuron] > model->values[model->layer_count - 1][label]) {
-            label = out_neuron;
-        }
+    data->pixels = images + 16;
+
+    data->_mapped.labels = map_file(labels_file_path, &data->_mapped.labels_size);
+    if (data->_mapped.labels == NULL) {
+        goto ERROR;
     }
 
-    return label;
+    unsigned char *labels = data->_mapped.labels;
+    if (data->_mapped.labels_size < 8 || big2lit(labels) != 2049) {
+        fprintf(stderr, "ERROR: labels file '%s' dont have correct magic number\n", labels_file_path);
+        goto ERROR;
+    }
+
+    if (big2lit(labels + 4) != data->meta.size || data->_mapped.labels_size < 8 + data->meta.size) {
+        fprintf(stderr, "ERROR: cannot read all image labels from file %s\n", labels_file_path);
+        goto ERROR;
+    }
+
+    data->labels = labels + 8;
+
+    printf("INFO: mapped %u images from %s in %.2f ms\n", data->meta.size, images_file_path, (now_secs() - start)*1000);
+    return true;
+
+ERROR:
+    denit_data(data);
+    return false;
 }
 
-internal void _train_model(RNA_Model *model, Data *training_data) {
-    model->training = true;
-    const size_t total_pixels = training_data->meta.rows*training_data->meta.cols;
-    const double lr = model->training_parameters->lr;
-    DA_APPEND(model->error_hist, ((Error) { .iteration = 0, .value = 1.0 }));
+typedef struct {
+    uint8_t *pixels;
+    uint8_t *labels;
+    size_t count;              // 0 marks the end of an epoch
+    bool full;
+} Stream_Buffer;
+
+// Double buffered reader: a background thread fills one buffer with the next chunk of the IDX
+// files while the training loop consumes the other one. Epochs follow each other without pause
+struct Data_Stream {
+    int images_fd;
+    int labels_fd;
+    uint32_t rows;
+    uint32_t cols;
+    size_t image_size;
+    size_t total;              // images in the dataset
+    size_t chunk_size;         // images per buffer
+
+    pthread_t handle;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    Stream_Buffer buffers[2];
+    size_t cursor;             // next image the producer reads
+    size_t producer_slot;
+    size_t consumer_slot;
+    bool holding;              // consumer still owns buffers[consumer_slot]
+    uint64_t generation;       // bumped by rewind, reads started before it are dropped
+    bool failed;               // a read failed, the epoch it ended is incomplete
+    bool quit;
+};
 
-    double global_error = 0;
-    for (int it = 0; it < model->training_parameters->max_iters; it++) {
-        model->epoch = it + 1;
-        for (size_t i = 0; i < training_data->meta.size; i++) {
-            size_t image_index = (i * total_pixels);
-            int8_t label = training_data->labels[i];
-
-            double *values = training_data->_images + image_index;
-            for (size_t layer = 0; layer < model->layer_count; layer++) {
-                for (size_t neuron = 0; neuron < model->neuron_cnt[layer]; neuron++) {
-                    double sum = sum_weights(get_neuron_weights(model, layer, neuron), values, model->weights_cnt[layer]);
-                    model->values[layer][neuron] = sigmoid(sum);
-                }
+internal void *_stream_reader(void *args) {
+    Data_Stream *stream = (Data_Stream *) args;
+    pthread_mutex_lock(&stream->lock);
+    while (!stream->quit) {
+        Stream_Buffer *buffer = &stream->buffers[stream->producer_slot];
+        if (buffer->full) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+            continue;
+        }
 
-                values = model->values[layer];
-            }
+        uint64_t generation = stream->generation;
+        size_t start = stream->cursor;
+        size_t count = stream->total - start < stream->chunk_size ? stream->total - start : stream->chunk_size;
+        pthread_mutex_unlock(&stream->lock);
 
-            double local_error = 0.;
-            const size_t out_layer = model->layer_count - 1;
-            for (int out_neuron = 0; out_neuron < (int) model->neuron_cnt[out_layer]; out_neuron++) {
-                double desired = out_neuron == label ? 1. : 0.;
-                double y = model->values[out_layer][out_neuron];
-                double error = (desired - y) * y * (1.0 - y);
-                local_error += (desired - y) * (desired - y);
-                double *weights = get_neuron_weights(model, out_layer, out_neuron);
-                for (size_t w_index = 0; w_index < model->weights_cnt[out_layer]; w_index++) {
-                    double delta = lr * error * model->values[out_layer - 1][w_index];
-                    weights[w_index] += delta;
-                }
+        bool ok = pread_all(stream->images_fd, buffer->pixels, count*stream->image_size, 16 + (off_t) start*stream->image_size)
+               && pread_all(stream->labels_fd, buffer->labels, count, 8 + (off_t) start);
+        if (!ok) {
+            fprintf(stderr, "ERROR: cannot read images %zu..%zu of the streamed dataset\n", start, start + count);
+            count = 0;
+        }
 
-                weights[model->weights_cnt[out_layer]] += lr * error;
-                model->errors[out_layer][out_neuron] = error;
-            }
+        pthread_mutex_lock(&stream->lock);
+        if (generation != stream->generation) {
+            continue;
+        }
+
+        stream->failed |= !ok;
+        buffer->count = count;
+        buffer->full = true;
+        stream->cursor = count == 0 ? 0 : start + count;
+        stream->producer_slot ^= 1;
+        pthread_cond_broadcast(&stream->changed);
+    }
 
-            global_error += local_error*0.5;
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
 
-            for (int layer = out_layer - 1; layer >= 0; layer--) {
-                uint32_t neuron_cnt = model->neuron_cnt[layer];
-                for (size_t neuron = 0; neuron < neuron_cnt; neuron++) {
-                    double error_sum = 0.0;
+bool open_data_stream(const char *images_file_path, const char *labels_file_path, size_t chunk_size, Data *data) {
+    Data_Stream *stream = calloc(1, sizeof(*stream));
+    assert(stream != NULL);
+    stream->images_fd = open(images_file_path, O_RDONLY);
+    stream->labels_fd = open(labels_file_path, O_RDONLY);
+    if (stream->images_fd < 0) {
+        fprintf(stderr, "ERROR: cannot open file '%s'\n", images_file_path);
+        goto ERROR;
+    }
 
-                    for (size_t next_neuron = 0; next_neuron < model->neuron_cnt[layer + 1]; next_neuron++) {
-                        double error = model->errors[layer + 1][next_neuron];
-                        double w = get_neuron_weights(model, layer + 1, next_neuron)[neuron];
-                        error_sum += w*error;
-                    }
+    if (stream->labels_fd < 0) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", labels_file_path);
+        goto ERROR;
+    }
 
-                    double y = model->values[layer][neuron];
-                    double error = error_sum * y * (1.0 - y);
+    static unsigned char metadata_buffer[16];
+    if (!pread_all(stream->images_fd, metadata_buffer, 16, 0) || big2lit(metadata_buffer) != 2051) {
+        fprintf(stderr, "ERROR: data file '%s' dont have correct magic number\n", images_file_path);
+        goto ERROR;
+    }
 
-                    uint32_t w_count = model->weights_cnt[layer];
-                    double *values_ = layer == 0 ? (training_data->_images + image_index) : model->values[layer - 1];
-                    double *weights = get_neuron_weights(model, layer, neuron);
-                    double scale = lr * error;
-                    for (size_t w_index = 0; w_index < w_count; w_index++) {
-                        weights[w_index] += scale * values_[w_index];
-                    }
+    data->meta.size = big2lit(metadata_buffer + 4);
+    data->meta.rows = big2lit(metadata_buffer + 8);
+    data->meta.cols = big2lit(metadata_buffer + 12);
+    data->stride = data->meta.rows * data->meta.cols;
 
-                    weights[w_count] += scale;
-                    model->errors[layer][neuron] = error;
-                }
-            }
+    if (!pread_all(stream->labels_fd, metadata_buffer, 8, 0) || big2lit(metadata_buffer) != 2049) {
+        fprintf(stderr, "ERROR: labels file '%s' dont have correct magic number\n", labels_file_path);
+        goto ERROR;
+    }
 
-            // check error sum each ERROR_VALIDATION_STEP iterations
-            int input_it = training_data->meta.size*it + (i + 1);
-            if (input_it % ERROR_VALIDATION_STEP == 0) {
-                global_error /= ERROR_VALIDATION_STEP;
-                printf("INFO: iteration: %d error: %f\n", input_it, global_error);
-                DA_APPEND(model->error_hist, ((Error) { .iteration = input_it, .value = global_error }));
-                if (global_error < model->training_parameters->tolerance) {
-                    goto CLEAN_UP;
-                }
-                global_error = 0.;
-            }
-        }
+    if (big2lit(metadata_buffer + 4) != data->meta.size) {
+        fprintf(stderr, "ERROR: labels file %s dont match the size of %s\n", labels_file_path, images_file_path);
+        goto ERROR;
     }
 
-CLEAN_UP:
-    model->training = false;
+    stream->rows = data->meta.rows;
+    stream->cols = data->meta.cols;
+    stream->image_size = data->stride;
+    stream->total = data->meta.size;
+    stream->chunk_size = chunk_size;
+    for (size_t i = 0; i < ARR_SIZE(stream->buffers); i++) {
+        stream->buffers[i].pixels = malloc(chunk_size*stream->image_size);
+        assert(stream->buffers[i].pixels != NULL);
+        stream->buffers[i].labels = malloc(chunk_size);
+        assert(stream->buffers[i].labels != NULL);
+    }
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+    pthread_create(&stream->handle, NULL, _stream_reader, (void *) stream);
+    data->_stream = stream;
+    return true;
+
+ERROR:
+    if (stream->images_fd >= 0) close(stream->images_fd);
+    if (stream->labels_fd >= 0) close(stream->labels_fd);
+    free(stream);
+    return false;
 }
 
-typedef struct {
-    RNA_Model *model;
-    Data *training_data;
-} Thread_Args;
+// Hands the next chunk of the epoch to the consumer, returns false once the epoch is over.
+// The chunk stays valid until the next call
+bool next_stream_chunk(Data_Stream *stream, Data *chunk) {
+    pthread_mutex_lock(&stream->lock);
+    if (stream->holding) {
+        stream->buffers[stream->consumer_slot].full = false;
+        stream->consumer_slot ^= 1;
+        stream->holding = false;
+        pthread_cond_broadcast(&stream->changed);
+    }
 
-internal void* _train_model_async(void *args) {
-    Thread_Args *td = (Thread_Args *) args;
-    if (train_model(td->model, td->training_data)) {
-        save_model(td->model);
+    Stream_Buffer *buffer = &stream->buffers[stream->consumer_slot];
+    while (!buffer->full) {
+        pthread_cond_wait(&stream->changed, &stream->lock);
     }
-    return NULL;
+
+    stream->holding = true;
+    pthread_mutex_unlock(&stream->lock);
+
+    if (buffer->count == 0) {
+        return false;
+    }
+
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->meta.size = buffer->count;
+    chunk->meta.rows = stream->rows;
+    chunk->meta.cols = stream->cols;
+    chunk->stride = stream->image_size;
+    chunk->pixels = buffer->pixels;
+    chunk->labels = buffer->labels;
+    return true;
 }
 
-void train_model_async(RNA_Model *model, Data *training_data) {
-    static pthread_t handle;
-    static Thread_Args args;
-    args.model = model;
-    args.training_data = training_data;
-    model->training = true;
-    pthread_create(&handle, NULL, _train_model_async, (void *)&args);
-    pthread_detach(handle);
+// Restarts the stream at the first image, dropping whatever was already prefetched
+void rewind_data_stream(Data_Stream *stream) {
+    pthread_mutex_lock(&stream->lock);
+    stream->generation++;
+    stream->failed = false;
+    stream->cursor = 0;
+    stream->producer_slot = 0;
+    stream->consumer_slot = 0;
+    stream->holding = false;
+    stream->buffers[0].full = false;
+    stream->buffers[1].full = false;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
 }
 
-void print_parameters(RNA_Parameters parameters) {
-    printf("+---------------------+\n");
-    printf("| Training Parameters |\n");
-    printf("+------------+--------+\n");
-    printf("| Tolerance  | %.4f |\n", parameters.tolerance);
-    printf("| LR         | %.4f |\n", parameters.lr);
-    printf("| Max Iters  |   %04d |\n", parameters.max_iters);
-    printf("+------------+--------+\n");
+bool data_stream_failed(Data_Stream *stream) {
+    pthread_mutex_lock(&stream->lock);
+    bool failed = stream->failed;
+    pthread_mutex_unlock(&stream->lock);
+    return failed;
 }
 
-internal double rand_w(float min, float max) {
-    return min + (float)rand()/(float)RAND_MAX*(max-min);
+internal void close_data_stream(Data_Stream *stream) {
+    pthread_mutex_lock(&stream->lock);
+    stream->quit = true;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->handle, NULL);
+
+    for (size_t i = 0; i < ARR_SIZE(stream->buffers); i++) {
+        free(stream->buffers[i].pixels);
+        free(stream->buffers[i].labels);
+    }
+
+    pthread_cond_destroy(&stream->changed);
+    pthread_mutex_destroy(&stream->lock);
+    close(stream->images_fd);
+    close(stream->labels_fd);
+    free(stream);
 }
 
-bool train_model(RNA_Model *model, Data *training_data) {
-    model->error_hist.count = 0;
-    model->epoch = 0;
-    DA_APPEND(model->error_hist, ((Error) { .iteration = 1, .value = 1.0 }));
+#define DATA_CACHE_VERSION 1
+#define DATA_CACHE_ALIGNMENT 64
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+#define MODEL_ALIGNMENT 64
 
-    if (model->training_parameters->config_path != NULL &&
-        !read_parameters_from_file(model->training_parameters->config_path, model->training_parameters)
-    ) {
-        fprintf(stderr, "ERROR: parameters could not be readed from file, stopping training...\n");
+// float builds keep their own cache so switching precision does not rebuild it every time
+#ifdef RNA_FLOAT32
+#define DATA_CACHE_SUFFIX ".f32.cache"
+#else
+#define DATA_CACHE_SUFFIX ".cache"
+#endif
+
+static const char data_cache_magic[] = "JDSC";
+
+// Header of the dataset cache written by `read_data` next to the images file. Samples are stored
+// normalized, starting at `images_offset` (aligned to DATA_CACHE_ALIGNMENT) with every row padded
+// to `stride` values, so the cache can be mapped and used as `Data._images` directly
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t value_size;
+    uint32_t size;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t stride;
+    uint32_t _padding;
+    uint64_t images_offset;
+    uint64_t labels_offset;
+    struct {
+        uint64_t size;
+        int64_t mtime_sec;
+        int64_t mtime_nsec;
+    } sources[2]; // images and labels files the cache was built from
+} Data_Cache_Header;
+
+internal bool stat_source(const char *file_path, uint64_t *size, int64_t *mtime_sec, int64_t *mtime_nsec) {
+    struct stat st;
+    if (stat(file_path, &st) < 0) {
         return false;
     }
 
-    print_parameters(*model->training_parameters);
+    *size = st.st_size;
+    *mtime_sec = st.st_mtim.tv_sec;
+    *mtime_nsec = st.st_mtim.tv_nsec;
+    return true;
+}
 
-    for (size_t i = 0; i < model->layer_count; i++) {
-        size_t neuron_cnt = model->neuron_cnt[i];
-        memset(model->errors[i], 0, sizeof(*model->errors[i]) * neuron_cnt);
-        size_t total_weights = (model->weights_cnt[i] + 1) * neuron_cnt;
-        for (size_t w = 0; w < total_weights; w++) {
-            model->weights[i][w] = rand_w(-0.5, 0.5);
+internal bool fill_cache_header(const char *images_file_path, const char *labels_file_path, Data_Cache_Header *header) {
+    memcpy(header->magic, data_cache_magic, sizeof(header->magic));
+    header->version = DATA_CACHE_VERSION;
+    header->value_size = sizeof(Real);
+    const char *sources[] = { images_file_path, labels_file_path };
+    for (size_t i = 0; i < ARR_SIZE(sources); i++) {
+        if (!stat_source(sources[i], &header->sources[i].size, &header->sources[i].mtime_sec, &header->sources[i].mtime_nsec)) {
+            return false;
         }
     }
 
-    struct timespec start, end;
-    assert(clock_gettime(CLOCK_MONOTONIC, &start) >= 0);
-    _train_model(model, training_data);
-    assert(clock_gettime(CLOCK_MONOTONIC, &end) >= 0);
-
-    float start_sec = start.tv_sec + start.tv_nsec/10e9;
-    float end_sec = end.tv_sec + end.tv_nsec/10e9;
-    float diff_in_secs = end_sec - start_sec;
-    printf("INFO: training finished\n");
-    printf("INFO: total training time: %.3f secs\n", diff_in_secs);
     return true;
 }
 
-internal void allocate_model(RNA_Model *model) {
-    uint32_t layer_cnt = model->layer_count;
-    model->values = malloc(sizeof(*model->values) * layer_cnt);
-    assert(model->values != NULL);
-
-    model->errors = malloc(sizeof(*model->errors) * layer_cnt);
-    assert(model->errors != NULL);
+// Maps the cache if it exists and was built from the current version of both source files
+internal bool map_data_cache(const char *cache_path, const char *images_file_path, const char *labels_file_path, Data *data) {
+    Data_Cache_Header expected = {0};
+    struct stat st;
+    if (stat(cache_path, &st) < 0 || (size_t) st.st_size < sizeof(expected)) {
+        return false;
+    }
 
-    model->weights = malloc(sizeof(model->weights) * layer_cnt);
-    assert(model->weights != NULL);
+    if (!fill_cache_header(images_file_path, labels_file_path, &expected)) {
+        return false;
+    }
 
-    model->weights_cnt = malloc(sizeof(*model->weights_cnt) * layer_cnt);
-    assert(model->weights_cnt != NULL);
+    size_t cache_size = 0;
+    Data_Cache_Header *header = map_file(cache_path, &cache_size);
+    if (header == NULL) {
+        return false;
+    }
 
-    if (model->neuron_cnt == NULL) {
-        model->neuron_cnt = malloc(sizeof(*model->neuron_cnt) * layer_cnt);
-        assert(model->neuron_cnt != NULL);
+    bool valid = memcmp(header->magic, expected.magic, sizeof(header->magic)) == 0
+        && header->version == expected.version
+        && header->value_size == expected.value_size
+        && memcmp(header->sources, expected.sources, sizeof(expected.sources)) == 0
+        && header->images_offset % DATA_CACHE_ALIGNMENT == 0
+        && header->images_offset + (uint64_t) header->size*header->stride*sizeof(Real) <= header->labels_offset
+        && header->labels_offset + header->size <= cache_size;
+
+    if (!valid) {
+        printf("INFO: dataset cache %s is stale, rebuilding it\n", cache_path);
+        munmap(header, cache_size);
+        return false;
     }
-}
 
-internal char *concat_path(char *dir, char *file) {
-    assert(file != NULL);
-    if (dir == NULL) return file;
-    int dir_len = strlen(dir) + 1;
-    assert(dir_len < 512 - 1 && "directory name is too big");
-    static char buffer[512];
-    memcpy(buffer, dir, dir_len);
-    buffer[dir_len-1] = '/';
-    strncpy(buffer + dir_len, file, 512 - dir_len);
-    return buffer;
+    data->meta.size = header->size;
+    data->meta.rows = header->rows;
+    data->meta.cols = header->cols;
+    data->stride = header->stride;
+    data->_images = (Real *) ((char *) header + header->images_offset);
+    data->labels = (uint8_t *) header + header->labels_offset;
+    data->_mapped.cache = header;
+    data->_mapped.cache_size = cache_size;
+    return true;
 }
 
-static const char magic[] = "JRNA";
-internal bool dump_model(char *out, RNA_Model *model) {
-    FILE *f = fopen(out, "wb");
-    bool ok = false;
+internal bool write_data_cache(const char *cache_path, const char *images_file_path, const char *labels_file_path, Data *data) {
+    Data_Cache_Header header = {0};
+    if (!fill_cache_header(images_file_path, labels_file_path, &header)) {
+        return false;
+    }
+
+    uint32_t image_size = data->meta.rows * data->meta.cols;
+    header.size = data->meta.size;
+    header.rows = data->meta.rows;
+    header.cols = data->meta.cols;
+    header.stride = ALIGN_UP(image_size, DATA_CACHE_ALIGNMENT / sizeof(Real));
+    header.images_offset = ALIGN_UP(sizeof(header), DATA_CACHE_ALIGNMENT);
+    header.labels_offset = header.images_offset + (uint64_t) header.size*header.stride*sizeof(Real);
+
+    // write to a temporary file first so a crash never leaves a truncated cache behind
+    static char tmp_path[512 + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+    FILE *f = fopen(tmp_path, "wb");
     if (f == NULL) {
-        fprintf(stderr, "ERROR: cannot open file %s\n", out);
-        goto ERROR;
+        return false;
     }
 
-    if (fwrite(magic, 1, ARR_SIZE(magic) - 1, f) == 0) {
-        LOG_WRITE_ERROR(out);
-        goto ERROR;
+    static const Real padding[DATA_CACHE_ALIGNMENT] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(padding, 1, header.images_offset - sizeof(header), f) == header.images_offset - sizeof(header);
+
+    for (size_t i = 0; ok && i < data->meta.size; i++) {
+        ok = fwrite(data->_images + i*data->stride, sizeof(Real), image_size, f) == image_size
+            && fwrite(padding, sizeof(Real), header.stride - image_size, f) == header.stride - image_size;
     }
 
-    if (fwrite(&model->layer_count, sizeof(model->layer_count), 1, f) == 0) {
-        LOG_WRITE_ERROR(out);
-        goto ERROR;
+    ok = ok && fwrite(data->labels, 1, data->meta.size, f) == data->meta.size;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path, cache_path) < 0) {
+        LOG_WRITE_ERROR(cache_path);
+        remove(tmp_path);
+        return false;
     }
 
-    for (size_t layer = 0; layer < model->layer_count; layer++) {
-        uint32_t neurons_cnt = model->neuron_cnt[layer];
-        uint32_t weights_cnt = model->weights_cnt[layer];
-        uint32_t total_weights = neurons_cnt*(weights_cnt + 1); // + 1 bias
+    return true;
+}
 
-        if (fwrite(&neurons_cnt, sizeof(neurons_cnt), 1, f) == 0) {
-            LOG_WRITE_ERROR(out);
-            goto ERROR;
-        }
+bool read_data(const char *images_file_path, const char *labels_file_path, Data *data) {
+    static char cache_path[512];
+    snprintf(cache_path, sizeof(cache_path), "%s" DATA_CACHE_SUFFIX, images_file_path);
+    double start = now_secs();
+    if (map_data_cache(cache_path, images_file_path, labels_file_path, data)) {
+        printf("INFO: loaded %u images from %s in %.2f ms\n", data->meta.size, cache_path, (now_secs() - start)*1000);
+        return true;
+    }
 
-        if (fwrite(&weights_cnt, sizeof(weights_cnt), 1, f) == 0) {
-            LOG_WRITE_ERROR(out);
-            goto ERROR;
-        }
+    if (!decode_data(images_file_path, labels_file_path, data)) {
+        return false;
+    }
 
-        if (fwrite(model->weights[layer], sizeof(double), total_weights, f) != total_weights) {
-            LOG_WRITE_ERROR(out);
-            goto ERROR;
-        }
+    printf("INFO: decoded %u images from %s in %.2f ms\n", data->meta.size, images_file_path, (now_secs() - start)*1000);
+
+    if (write_data_cache(cache_path, images_file_path, labels_file_path, data)) {
+        printf("INFO: wrote dataset cache %s\n", cache_path);
+    } else {
+        fprintf(stderr, "WARNING: could not write dataset cache %s\n", cache_path);
     }
 
-    ok = true;
-ERROR:
-    if(f) fclose(f);
-    return ok;
+    return true;
 }
 
-bool load_model(char *in, RNA_Model *model) {
-    FILE *f = fopen(in, "rb");
-    bool status = false;
-    if (f == NULL) {
-        fprintf(stderr, "ERROR: cannot open file %s\n", in);
-        goto ERROR;
+void denit_data(Data *data) {
+    free(data->_nz_offsets);
+    free(data->_nz_index);
+    free(data->_nz_pixels);
+    data->_nz_offsets = NULL;
+    data->_nz_index = NULL;
+    data->_nz_pixels = NULL;
+    if (data->_stream) {
+        close_data_stream(data->_stream);
+        memset(data, 0, sizeof(*data));
+        return;
     }
 
-    static unsigned char magic_buffer[4];
-    if (fread(&magic_buffer, sizeof(magic_buffer), 1, f) == 0) {
-        LOG_READ_ERROR("magic value", in);
-        goto ERROR;
+    if (data->_mapped.cache) {
+        munmap(data->_mapped.cache, data->_mapped.cache_size);
+        memset(data, 0, sizeof(*data));
+        return;
     }
 
-    if (memcmp(magic, magic_buffer, 4) != 0) {
-        fprintf(stderr, "ERROR: first 4 bytes of file %s dont match magic constant %*s\n", in, 4, magic);
-        goto ERROR;
+    if (data->_mapped.images) {
+        munmap(data->_mapped.images, data->_mapped.images_size);
+    } else if (data->_images) {
+        free(data->_images);
     }
 
-    if (fread(&model->layer_count, sizeof(model->layer_count), 1, f) == 0) {
-        LOG_READ_ERROR("layer_count", in);
-        goto ERROR;
+    if (data->_mapped.labels) {
+        munmap(data->_mapped.labels, data->_mapped.labels_size);
+    } else if (data->labels) {
+        free(data->labels);
     }
 
-    // pre allocate a bunch of fields
-    allocate_model(model);
+    memset(data, 0, sizeof(*data));
+}
+
+// Carves `bytes` out of the arena at `*cursor`, keeping the next buffer MODEL_ALIGNMENT aligned
+internal void *arena_take(uint8_t **cursor, size_t bytes) {
+    void *buffer = *cursor;
+    *cursor += ALIGN_UP(bytes, MODEL_ALIGNMENT);
+    return buffer;
+}
+
+internal Real sum_weights(Real *weights, Real bias, Real *values, size_t cnt) {
+    return kernels.dot(weights, values, cnt) + bias;
+}
+
+internal Real *get_neuron_weights(RNA_Model *model, uint32_t layer, uint32_t neuron) {
+    return model->weights[layer] + neuron*model->weights_stride[layer];
+}
+
+// Mixed kernel for the first layer: pixels are kept as uint8 and the 1/255 scale is folded
+// out of the accumulation, so mapped datasets are read byte by byte and never widened in memory
+internal Real dot_product_u8(Real *weights, uint8_t *pixels, size_t cnt) {
+    return kernels.dot_u8(weights, pixels, cnt) * PIXEL_SCALE;
+}
+
+// weights += scale * pixels/255
+internal void update_weights_u8(Real *weights, uint8_t *pixels, Real scale, size_t cnt) {
+    kernels.axpy_u8(weights, scale * PIXEL_SCALE, pixels, cnt);
+}
+
+internal Real sum_weights_u8(Real *weights, Real bias, uint8_t *pixels, size_t cnt) {
+    return dot_product_u8(weights, pixels, cnt) + bias;
+}
+
+// Feeds either a normalized `image` or raw `pixels` (the other one is NULL) through the layers
+// from `first` on, the ones before must already hold their values
+internal void feed_layers(RNA_Model *model, size_t first, Real *image, uint8_t *pixels) {
+    if (model->_topology != NULL && first <= 1) {
+        model->_topology->forward(model->weights, model->biases, first == 0 ? image : NULL, first == 0 ? pixels : NULL, model->values);
+        return;
+    }
+
+    Real *values = first == 0 ? image : model->values[first - 1];
+    for (size_t layer = first; layer < model->layer_count; layer++) {
+        for (size_t neuron = 0; neuron < model->neuron_cnt[layer]; neuron++) {
+            Real *weights = get_neuron_weights(model, layer, neuron);
+            Real bias = model->biases[layer][neuron];
+            model->values[layer][neuron] = layer == 0 && pixels != NULL
+                ? sum_weights_u8(weights, bias, pixels, model->weights_cnt[layer])
+                : sum_weights(weights, bias, values, model->weights_cnt[layer]);
+        }
+
+        kernels.sigmoid(model->values[layer], model->neuron_cnt[layer]);
+
+        values = model->values[layer];
+    }
+}
+
+internal void feed_forward(RNA_Model *model, Real *image, uint8_t *pixels) {
+    feed_layers(model, 0, image, pixels);
+}
+
+// Nonzero pixels of one image, see `Data._nz_offsets`
+typedef struct {
+    const uint16_t *index;
+    const uint8_t *pixels;
+    size_t cnt;
+} Sparse_Image;
+
+internal Sparse_Image sparse_image(const Data *data, size_t index) {
+    size_t first = data->_nz_offsets[index];
+    return (Sparse_Image) {
+        .index = data->_nz_index + first,
+        .pixels = data->_nz_pixels + first,
+        .cnt = data->_nz_offsets[index + 1] - first,
+    };
+}
+
+// Most pixels are 0, so on sparse inputs layer 0 is computed from its weight columns: every
+// nonzero pixel adds its column to the layer values, a few hundred contiguous axpys instead of
+// full rows. It needs the column major copy of the weights in `_columns`
+internal void feed_forward_sparse(RNA_Model *model, Sparse_Image image) {
+    uint32_t neurons = model->neuron_cnt[0];
+    size_t column_stride = ALIGN_UP(neurons, MODEL_ALIGNMENT / sizeof(Real));
+    Real *values = model->values[0];
+    memcpy(values, model->biases[0], sizeof(*values) * neurons);
+    for (size_t k = 0; k < image.cnt; k++) {
+        kernels.axpy(values, image.pixels[k] * PIXEL_SCALE, model->_columns + image.index[k]*column_stride, neurons);
+    }
+
+    kernels.sigmoid(values, neurons);
+    feed_layers(model, 1, NULL, NULL);
+}
+
+internal int output_label(RNA_Model *model) {
+    int label = 0;
+    for (size_t out_neuron = 1; out_neuron < model->neuron_cnt[model->layer_count - 1]; out_neuron++) {
+        if (model->values[model->layer_count - 1][out_neuron] > model->values[model->layer_count - 1][label]) {
+            label = out_neuron;
+        }
+    }
+
+    return label;
+}
+
+int find_label(RNA_Model *model, Real *image) {
+    feed_forward(model, image, NULL);
+    return output_label(model);
+}
+
+int find_label_at(RNA_Model *model, Data *data, size_t index) {
+    size_t image_index = index * data->stride;
+    if (data->pixels != NULL) {
+        feed_forward(model, NULL, data->pixels + image_index);
+    } else {
+        feed_forward(model, data->_images + image_index, NULL);
+    }
+
+    return output_label(model);
+}
+
+// Backward pass and update after `feed_forward`, returns the summed squared error of the outputs.
+// Layer 0 rows are updated from either `image` or `pixels`, with neither they are left alone
+internal double backpropagate(RNA_Model *model, Real *image, uint8_t *pixels, uint8_t label, Real lr) {
+    double local_error = 0.;
+    const size_t out_layer = model->layer_count - 1;
+    for (size_t out_neuron = 0; out_neuron < model->neuron_cnt[out_layer]; out_neuron++) {
+        Real desired = out_neuron == label ? 1 : 0;
+        Real y = model->values[out_layer][out_neuron];
+        model->errors[out_layer][out_neuron] = (desired - y) * y * (1 - y);
+        local_error += (desired - y) * (desired - y);
+    }
+
+    // every row of a layer is swept once: it adds to the error sums of the layer below
+    // (W^T * errors) with its weights before the update, then takes the update
+    for (size_t layer = out_layer; layer > 0; layer--) {
+        uint32_t below_cnt = model->neuron_cnt[layer - 1];
+        Real *error_sums = model->errors[layer - 1];
+        memset(error_sums, 0, sizeof(*error_sums) * below_cnt);
+        for (size_t neuron = 0; neuron < model->neuron_cnt[layer]; neuron++) {
+            Real error = model->errors[layer][neuron];
+            Real *weights = get_neuron_weights(model, layer, neuron);
+            kernels.axpy_fused(error_sums, error, weights, lr * error, model->values[layer - 1], model->weights_cnt[layer]);
+            model->biases[layer][neuron] += lr * error;
+        }
+
+        for (size_t neuron = 0; neuron < below_cnt; neuron++) {
+            Real y = model->values[layer - 1][neuron];
+            error_sums[neuron] = error_sums[neuron] * y * (1 - y);
+        }
+    }
+
+    // layer 0 has no error to pass on, its rows only take the update
+    for (size_t neuron = 0; neuron < model->neuron_cnt[0]; neuron++) {
+        uint32_t w_count = model->weights_cnt[0];
+        Real *weights = get_neuron_weights(model, 0, neuron);
+        Real scale = lr * model->errors[0][neuron];
+        if (pixels != NULL) {
+            update_weights_u8(weights, pixels, scale, w_count);
+        } else if (image != NULL) {
+            kernels.axpy(weights, scale, image, w_count);
+        }
+
+        model->biases[0][neuron] += scale;
+    }
+
+    return local_error;
+}
+
+// Runs one online SGD step on a single sample and returns its squared error / 2. With `sparse`
+// (and `_columns`) layer 0 reads and updates only the weight columns of the nonzero pixels.
+// A step is short next to reading the clock, so only one in TIMING_SAMPLE_STEP is timed and
+// counted for all of them
+internal double train_sample(RNA_Model *model, Real *image, uint8_t *pixels, const Sparse_Image *sparse, uint8_t label) {
+    const Real lr = model->training_parameters->lr;
+    bool timed = model->_timing_tick++ % TIMING_SAMPLE_STEP == 0;
+    double start = timed ? now_secs() : 0.;
+    if (sparse != NULL) {
+        feed_forward_sparse(model, *sparse);
+        image = NULL;
+        pixels = NULL;
+    } else {
+        feed_forward(model, image, pixels);
+    }
+    double forward_end = 0.;
+    if (timed) {
+        forward_end = now_secs();
+        model->forward_secs += (forward_end - start)*TIMING_SAMPLE_STEP;
+    }
+
+    double local_error = model->_topology != NULL
+        ? model->_topology->backward(model->weights, model->biases, model->values, model->errors, image, pixels, label, lr)
+        : backpropagate(model, image, pixels, label, lr);
+
+    // the layer 0 columns are updated once all the errors of the layer are known
+    if (sparse != NULL) {
+        uint32_t neurons = model->neuron_cnt[0];
+        size_t column_stride = ALIGN_UP(neurons, MODEL_ALIGNMENT / sizeof(Real));
+        for (size_t k = 0; k < sparse->cnt; k++) {
+            Real *column = model->_columns + sparse->index[k]*column_stride;
+            kernels.axpy(column, lr * sparse->pixels[k] * PIXEL_SCALE, model->errors[0], neurons);
+        }
+    }
+
+    if (timed) {
+        model->backward_secs += (now_secs() - forward_end)*TIMING_SAMPLE_STEP;
+    }
+
+    return local_error*0.5;
+}
+
+// Activations and errors of a whole minibatch, every buffer is row major with one row per sample
+typedef struct {
+    size_t capacity;           // samples per batch
+    Real *input;               // capacity x weights_cnt[0], widened pixels of mapped or streamed datasets
+    Real **values;             // layer -> capacity x neuron_cnt[layer]
+    Real **errors;             // layer -> capacity x neuron_cnt[layer]
+} Batch_Workspace;
+
+internal Batch_Workspace allocate_batch_workspace(RNA_Model *model, size_t capacity) {
+    Batch_Workspace ws = { .capacity = capacity };
+    ws.input = malloc(sizeof(*ws.input) * capacity * model->weights_cnt[0]);
+    assert(ws.input != NULL);
+
+    ws.values = malloc(sizeof(*ws.values) * model->layer_count);
+    assert(ws.values != NULL);
+    ws.errors = malloc(sizeof(*ws.errors) * model->layer_count);
+    assert(ws.errors != NULL);
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        ws.values[layer] = malloc(sizeof(*ws.values[layer]) * capacity * model->neuron_cnt[layer]);
+        assert(ws.values[layer] != NULL);
+        ws.errors[layer] = malloc(sizeof(*ws.errors[layer]) * capacity * model->neuron_cnt[layer]);
+        assert(ws.errors[layer] != NULL);
+    }
+
+    return ws;
+}
+
+internal void free_batch_workspace(RNA_Model *model, Batch_Workspace *ws) {
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        free(ws->values[layer]);
+        free(ws->errors[layer]);
+    }
+
+    free(ws->values);
+    free(ws->errors);
+    free(ws->input);
+}
+
+// Points `*input` at the first layer inputs of samples [first, first + count) of `chunk`, raw pixels
+// are widened into the workspace. Returns the stride between two samples of `*input`
+internal size_t batch_input(const RNA_Model *model, Batch_Workspace *ws, const Data *chunk, size_t first, size_t count, Real **input) {
+    if (chunk->pixels == NULL) {
+        *input = chunk->_images + first*chunk->stride;
+        return chunk->stride;
+    }
+
+    size_t input_stride = model->weights_cnt[0];
+    for (size_t b = 0; b < count; b++) {
+        uint8_t *pixels = chunk->pixels + (first + b)*chunk->stride;
+        Real *row = ws->input + b*input_stride;
+        for (size_t k = 0; k < input_stride; k++) {
+            row[k] = pixels[k] * PIXEL_SCALE;
+        }
+    }
+
+    *input = ws->input;
+    return input_stride;
+}
+
+internal void batch_forward(const RNA_Model *model, Batch_Workspace *ws, Real *input, size_t input_stride, size_t count) {
+    Real *x = input;
+    size_t ldx = input_stride;
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        uint32_t n = model->neuron_cnt[layer];
+        uint32_t k = model->weights_cnt[layer];
+        Real *values = ws->values[layer];
+        kernels.gemm_nt(count, n, k, x, ldx, model->weights[layer], model->weights_stride[layer], values, n);
+        for (size_t b = 0; b < count; b++) {
+            kernels.axpy(values + b*n, 1, model->biases[layer], n);
+        }
+
+        kernels.sigmoid(values, count*n);
+        x = values;
+        ldx = n;
+    }
+}
+
+// Computes the errors of every layer for the batch in `ws` and returns its summed squared error / 2
+internal double batch_errors(RNA_Model *model, Batch_Workspace *ws, uint8_t *labels, size_t count) {
+    const size_t out_layer = model->layer_count - 1;
+    double batch_error = 0.;
+    uint32_t out_cnt = model->neuron_cnt[out_layer];
+    for (size_t b = 0; b < count; b++) {
+        for (size_t out_neuron = 0; out_neuron < out_cnt; out_neuron++) {
+            Real desired = out_neuron == labels[b] ? 1 : 0;
+            Real y = ws->values[out_layer][b*out_cnt + out_neuron];
+            ws->errors[out_layer][b*out_cnt + out_neuron] = (desired - y) * y * (1 - y);
+            batch_error += (desired - y) * (desired - y);
+        }
+    }
+
+    // propagate the errors through the weights of the whole batch before any of them change
+    for (size_t layer = out_layer; layer > 0; layer--) {
+        uint32_t n = model->neuron_cnt[layer];
+        uint32_t k = model->weights_cnt[layer];
+        Real *errors = ws->errors[layer - 1];
+        Real *values = ws->values[layer - 1];
+        memset(errors, 0, sizeof(*errors) * count * k);
+        kernels.gemm_acc(count, k, n, ws->errors[layer], n, 1, model->weights[layer], model->weights_stride[layer], errors, k);
+        for (size_t i = 0; i < count*k; i++) {
+            errors[i] *= values[i] * (1 - values[i]);
+        }
+    }
+
+    return batch_error*0.5;
+}
+
+// weights += lr * errors^T * layer inputs and biases += lr * errors, one update per layer for the
+// whole batch. `weights` and `biases` have the layout of the model ones, errors are scaled in place
+internal void batch_update(RNA_Model *model, Batch_Workspace *ws, Real *input, size_t input_stride, size_t count, Real lr, Real **weights, Real **biases) {
+    Real *x = input;
+    size_t ldx = input_stride;
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        uint32_t n = model->neuron_cnt[layer];
+        uint32_t k = model->weights_cnt[layer];
+        Real *errors = ws->errors[layer];
+        for (size_t i = 0; i < count*n; i++) {
+            errors[i] *= lr;
+        }
+
+        kernels.gemm_acc(n, k, count, errors, 1, n, x, ldx, weights[layer], model->weights_stride[layer]);
+        for (size_t b = 0; b < count; b++) {
+            kernels.axpy(biases[layer], 1, errors + b*n, n);
+        }
+
+        x = ws->values[layer];
+        ldx = n;
+    }
+}
+
+// Runs one minibatch SGD step over `count` samples of `chunk` starting at `first`: forward and
+// backward passes are matrix-matrix products over the whole batch and the weights are updated once,
+// with the gradients summed over the batch so `lr` keeps its per sample meaning. Returns the
+// summed squared error / 2 of the batch
+internal double train_batch(RNA_Model *model, Batch_Workspace *ws, Data *chunk, size_t first, size_t count) {
+    double start = now_secs();
+    Real *input;
+    size_t input_stride = batch_input(model, ws, chunk, first, count, &input);
+    batch_forward(model, ws, input, input_stride, count);
+    double forward_end = now_secs();
+    model->forward_secs += forward_end - start;
+
+    double batch_error = batch_errors(model, ws, chunk->labels + first, count);
+    batch_update(model, ws, input, input_stride, count, model->training_parameters->lr, model->weights, model->biases);
+    model->backward_secs += now_secs() - forward_end;
+    return batch_error;
+}
+
+size_t inference_workspace_size(const RNA_Model *model, size_t count) {
+    size_t size = MODEL_ALIGNMENT // room to align the caller's buffer
+                + ALIGN_UP(sizeof(Real *) * model->layer_count, MODEL_ALIGNMENT)
+                + ALIGN_UP(sizeof(Real) * count * model->weights_cnt[0], MODEL_ALIGNMENT);
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        size += ALIGN_UP(sizeof(Real) * count * model->neuron_cnt[layer], MODEL_ALIGNMENT);
+    }
+
+    return size;
+}
+
+void infer_batch(const RNA_Model *model, const Data *images, size_t first, size_t count, void *workspace, uint8_t *labels, Real *scores) {
+    uint8_t *cursor = (uint8_t *) ALIGN_UP((uintptr_t) workspace, MODEL_ALIGNMENT);
+    Batch_Workspace ws = { .capacity = count };
+    ws.values = arena_take(&cursor, sizeof(Real *) * model->layer_count);
+    ws.input = arena_take(&cursor, sizeof(Real) * count * model->weights_cnt[0]);
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        ws.values[layer] = arena_take(&cursor, sizeof(Real) * count * model->neuron_cnt[layer]);
+    }
+
+    Real *input;
+    size_t input_stride = batch_input(model, &ws, images, first, count, &input);
+    batch_forward(model, &ws, input, input_stride, count);
+
+    const size_t out_layer = model->layer_count - 1;
+    const uint32_t out_cnt = model->neuron_cnt[out_layer];
+    for (size_t b = 0; b < count; b++) {
+        Real *outputs = ws.values[out_layer] + b*out_cnt;
+        uint8_t label = 0;
+        for (size_t out_neuron = 1; out_neuron < out_cnt; out_neuron++) {
+            if (outputs[out_neuron] > outputs[label]) label = out_neuron;
+        }
+
+        labels[b] = label;
+    }
+
+    if (scores != NULL) {
+        memcpy(scores, ws.values[out_layer], sizeof(*scores) * count * out_cnt);
+    }
+}
+
+#define EVAL_BATCH_SIZE 64
+#define MAX_EVAL_THREADS 256
+
+typedef struct {
+    RNA_Model *model;
+    Data *data;
+    size_t first;              // images [first, end) of `data`
+    size_t end;
+    size_t batch_size;
+    size_t correct;
+} Eval_Args;
+
+internal void *_eval_worker(void *args) {
+    Eval_Args *ea = (Eval_Args *) args;
+    void *workspace = malloc(inference_workspace_size(ea->model, ea->batch_size));
+    assert(workspace != NULL);
+    uint8_t *labels = malloc(ea->batch_size);
+    assert(labels != NULL);
+
+    for (size_t first = ea->first; first < ea->end; first += ea->batch_size) {
+        size_t count = ea->end - first < ea->batch_size ? ea->end - first : ea->batch_size;
+        infer_batch(ea->model, ea->data, first, count, workspace, labels, NULL);
+        for (size_t b = 0; b < count; b++) {
+            if (labels[b] == ea->data->labels[first + b]) ea->correct++;
+        }
+    }
+
+    free(labels);
+    free(workspace);
+    return NULL;
+}
+
+size_t evaluate_model(RNA_Model *model, Data *data, uint32_t threads, size_t batch_size) {
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? cores : 1;
+    }
+
+    if (batch_size == 0) {
+        batch_size = EVAL_BATCH_SIZE;
+    }
+
+    if (threads > MAX_EVAL_THREADS) {
+        threads = MAX_EVAL_THREADS;
+    }
+
+    // no point in waking a thread for less than a batch
+    if (threads > (data->meta.size + batch_size - 1) / batch_size) {
+        threads = (data->meta.size + batch_size - 1) / batch_size;
+    }
+
+    if (threads == 0) {
+        return 0;
+    }
+
+    pthread_t handles[threads];
+    Eval_Args args[threads];
+    size_t per_thread = data->meta.size / threads;
+    for (uint32_t t = 0; t < threads; t++) {
+        args[t] = (Eval_Args) {
+            .model = model,
+            .data = data,
+            .first = t*per_thread,
+            .end = t == threads - 1 ? data->meta.size : (t + 1)*per_thread,
+            .batch_size = batch_size,
+        };
+        if (t > 0) {
+            pthread_create(&handles[t], NULL, _eval_worker, (void *) &args[t]);
+        }
+    }
+
+    _eval_worker(&args[0]);
+    size_t correct = args[0].correct;
+    for (uint32_t t = 1; t < threads; t++) {
+        pthread_join(handles[t], NULL);
+        correct += args[t].correct;
+    }
+
+    return correct;
+}
+
+// Resident datasets are a single chunk, streamed ones are handed out chunk by chunk.
+// `consumed` is the number of samples of the current epoch already trained on
+internal bool next_chunk(Data *data, Data *chunk, size_t consumed) {
+    if (data->_stream != NULL) {
+        return next_stream_chunk(data->_stream, chunk);
+    }
+
+    if (consumed > 0) {
+        return false;
+    }
+
+    *chunk = *data;
+    return true;
+}
+
+// Builds `_nz_offsets`, `_nz_index` and `_nz_pixels` of a resident dataset, once
+internal void build_sparse_index(Data *data) {
+    if (data->_nz_offsets != NULL) return;
+
+    size_t image_size = data->meta.rows * data->meta.cols;
+    size_t nonzero = 0;
+    for (size_t i = 0; i < data->meta.size; i++) {
+        for (size_t p = 0; p < image_size; p++) {
+            size_t index = i*data->stride + p;
+            nonzero += data->pixels != NULL ? data->pixels[index] != 0 : data->_images[index] != 0;
+        }
+    }
+
+    data->_nz_offsets = malloc(sizeof(*data->_nz_offsets) * (data->meta.size + 1));
+    assert(data->_nz_offsets != NULL);
+    data->_nz_index = malloc(sizeof(*data->_nz_index) * (nonzero + 1));
+    assert(data->_nz_index != NULL);
+    data->_nz_pixels = malloc(sizeof(*data->_nz_pixels) * (nonzero + 1));
+    assert(data->_nz_pixels != NULL);
+
+    size_t k = 0;
+    for (size_t i = 0; i < data->meta.size; i++) {
+        data->_nz_offsets[i] = k;
+        for (size_t p = 0; p < image_size; p++) {
+            size_t index = i*data->stride + p;
+            long value = data->pixels != NULL ? data->pixels[index] : lrint(data->_images[index] * 255);
+            if (value == 0) continue;
+            data->_nz_index[k] = p;
+            data->_nz_pixels[k] = value;
+            k++;
+        }
+    }
+    data->_nz_offsets[data->meta.size] = k;
+}
+
+// Copies the layer 0 weights between their rows and `_columns`
+internal void columns_from_rows(RNA_Model *model) {
+    size_t column_stride = ALIGN_UP(model->neuron_cnt[0], MODEL_ALIGNMENT / sizeof(Real));
+    for (size_t neuron = 0; neuron < model->neuron_cnt[0]; neuron++) {
+        Real *weights = get_neuron_weights(model, 0, neuron);
+        for (size_t p = 0; p < model->weights_cnt[0]; p++) {
+            model->_columns[p*column_stride + neuron] = weights[p];
+        }
+    }
+}
+
+internal void rows_from_columns(RNA_Model *model) {
+    size_t column_stride = ALIGN_UP(model->neuron_cnt[0], MODEL_ALIGNMENT / sizeof(Real));
+    for (size_t neuron = 0; neuron < model->neuron_cnt[0]; neuron++) {
+        Real *weights = get_neuron_weights(model, 0, neuron);
+        for (size_t p = 0; p < model->weights_cnt[0]; p++) {
+            weights[p] = model->_columns[p*column_stride + neuron];
+        }
+    }
+}
+
+// Trains on samples [first, end) of `chunk`, `batch_size` at a time, and returns their summed squared error / 2
+internal double train_range(RNA_Model *model, Batch_Workspace *ws, Data *chunk, size_t first, size_t end, size_t batch_size) {
+    double error = 0.;
+    for (size_t j = first; j < end; j += batch_size) {
+        size_t count = end - j < batch_size ? end - j : batch_size;
+        if (batch_size > 1) {
+            error += train_batch(model, ws, chunk, j, count);
+        } else {
+            size_t image_index = (j * chunk->stride);
+            Real *image = chunk->pixels == NULL ? chunk->_images + image_index : NULL;
+            uint8_t *pixels = chunk->pixels == NULL ? NULL : chunk->pixels + image_index;
+            Sparse_Image sparse;
+            if (model->_columns != NULL) {
+                sparse = sparse_image(chunk, j);
+            }
+
+            error += train_sample(model, image, pixels, model->_columns != NULL ? &sparse : NULL, chunk->labels[j]);
+        }
+    }
+
+    return error;
+}
+
+#define MAX_TRAIN_THREADS 256
+
+typedef struct {
+    RNA_Model *model;          // the trained model for worker 0, `shadow` for the others
+    RNA_Model shadow;          // shares the weights of the trained model, values, errors and timings are private
+    Batch_Workspace ws;
+    size_t batch_size;
+
+    Data *chunk;
+    size_t first;              // samples [first, end) of `chunk` trained in the current round
+    size_t end;
+    double error;
+} Train_Worker;
+
+internal void init_train_worker(Train_Worker *worker, RNA_Model *model, bool shadow, size_t batch_size) {
+    *worker = (Train_Worker) { .model = model, .batch_size = batch_size };
+    if (shadow) {
+        worker->shadow = *model;
+        worker->shadow.forward_secs = 0;
+        worker->shadow.backward_secs = 0;
+        worker->shadow.values = malloc(sizeof(*worker->shadow.values) * model->layer_count);
+        assert(worker->shadow.values != NULL);
+        worker->shadow.errors = malloc(sizeof(*worker->shadow.errors) * model->layer_count);
+        assert(worker->shadow.errors != NULL);
+        for (size_t layer = 0; layer < model->layer_count; layer++) {
+            worker->shadow.values[layer] = malloc(sizeof(Real) * model->neuron_cnt[layer]);
+            assert(worker->shadow.values[layer] != NULL);
+            worker->shadow.errors[layer] = malloc(sizeof(Real) * model->neuron_cnt[layer]);
+            assert(worker->shadow.errors[layer] != NULL);
+        }
+
+        worker->model = &worker->shadow;
+    }
+
+    if (batch_size > 1) {
+        worker->ws = allocate_batch_workspace(model, batch_size);
+    }
+}
+
+// Frees the private buffers of `worker` and adds its timings to `model`
+internal void denit_train_worker(Train_Worker *worker, RNA_Model *model) {
+    if (worker->model == &worker->shadow) {
+        model->forward_secs += worker->shadow.forward_secs;
+        model->backward_secs += worker->shadow.backward_secs;
+        for (size_t layer = 0; layer < model->layer_count; layer++) {
+            free(worker->shadow.values[layer]);
+            free(worker->shadow.errors[layer]);
+        }
+
+        free(worker->shadow.values);
+        free(worker->shadow.errors);
+    }
+
+    if (worker->batch_size > 1) {
+        free_batch_workspace(model, &worker->ws);
+    }
+}
+
+internal void *_train_worker(void *args) {
+    Train_Worker *worker = (Train_Worker *) args;
+    worker->error = train_range(worker->model, &worker->ws, worker->chunk, worker->first, worker->end, worker->batch_size);
+    return NULL;
+}
+
+// Hogwild round: worker `t` trains on the next `round` samples of the t-th contiguous shard of
+// `chunk`, starting `offset` samples into it. Workers update the shared weights without any
+// locking, the occasional lost update costs less than synchronizing every sample would.
+// Worker 0 runs on the calling thread. Returns the number of samples trained on
+internal size_t train_round(Train_Worker *workers, uint32_t threads, Data *chunk, size_t offset, size_t round, double *error) {
+    size_t shard = (chunk->meta.size + threads - 1) / threads;
+    pthread_t handles[threads];
+    size_t count = 0;
+    for (uint32_t t = 0; t < threads; t++) {
+        size_t shard_end = (t + 1)*shard < chunk->meta.size ? (t + 1)*shard : chunk->meta.size;
+        size_t first = t*shard + offset;
+        Train_Worker *worker = &workers[t];
+        worker->chunk = chunk;
+        worker->first = first < shard_end ? first : shard_end;
+        worker->end = first + round < shard_end ? first + round : shard_end;
+        count += worker->end - worker->first;
+        if (t > 0) {
+            pthread_create(&handles[t], NULL, _train_worker, (void *) worker);
+        }
+    }
+
+    _train_worker(&workers[0]);
+    for (uint32_t t = 1; t < threads; t++) {
+        pthread_join(handles[t], NULL);
+    }
+
+    // summed in worker order so the reported error does not depend on scheduling
+    for (uint32_t t = 0; t < threads; t++) {
+        *error += workers[t].error;
+    }
+
+    return count;
+}
+
+// Minibatches of the synchronous mode are cut in slices of this size whatever the thread count,
+// so the gradients and the order they are summed in only depend on the batch size
+#define SYNC_SLICE_SIZE 16
+
+// Gradient of one slice of a minibatch, every layer's weights (neuron_cnt x weights_stride)
+// followed by its biases in a single buffer
+typedef struct {
+    Batch_Workspace ws;
+    Real *gradient;
+    Real **weights;            // layer -> start of its weights in `gradient`
+    Real **biases;             // layer -> start of its biases in `gradient`
+    double error;
+    double forward_secs;
+    double backward_secs;
+} Sync_Slice;
+
+typedef struct Sync_Trainer Sync_Trainer;
+
+typedef struct {
+    Sync_Trainer *trainer;
+    uint32_t index;
+    pthread_t handle;
+} Sync_Worker;
+
+// Synchronous data parallel training: the slices of every minibatch are spread over the workers,
+// each slice writes its own gradient and the gradients are combined with a fixed-order tree
+// reduction before being applied once to the model. Runs are bit-identical for any thread count
+struct Sync_Trainer {
+    RNA_Model *model;
+    uint32_t threads;
+    Sync_Worker *workers;      // workers[0] is the training thread itself
+    pthread_barrier_t barrier;
+    Sync_Slice *slices;
+    size_t slice_cnt;
+    size_t gradient_size;      // Reals per slice gradient
+
+    // minibatch of the current step
+    Data *chunk;
+    size_t first;
+    size_t count;
+    bool done;
+};
+
+internal void sync_compute_slice(Sync_Trainer *st, Sync_Slice *slice, size_t first, size_t count) {
+    RNA_Model *model = st->model;
+    double start = now_secs();
+    Real *input;
+    size_t input_stride = batch_input(model, &slice->ws, st->chunk, first, count, &input);
+    batch_forward(model, &slice->ws, input, input_stride, count);
+    double forward_end = now_secs();
+    slice->forward_secs += forward_end - start;
+
+    slice->error = batch_errors(model, &slice->ws, st->chunk->labels + first, count);
+    memset(slice->gradient, 0, sizeof(*slice->gradient) * st->gradient_size);
+    batch_update(model, &slice->ws, input, input_stride, count, model->training_parameters->lr, slice->weights, slice->biases);
+    slice->backward_secs += now_secs() - forward_end;
+}
+
+// Worker `t` reduces its share of `len` values at `offset` of the first `slices` gradients into
+// slice 0, always pairing the same slices in the same order, then adds the sum to `target`
+internal void sync_reduce_range(Sync_Trainer *st, uint32_t t, size_t slices, size_t offset, size_t len, Real *target) {
+    size_t lo = len*t/st->threads;
+    size_t hi = len*(t + 1)/st->threads;
+    if (lo == hi) {
+        return;
+    }
+
+    for (size_t step = 1; step < slices; step *= 2) {
+        for (size_t s = 0; s + step < slices; s += 2*step) {
+            kernels.axpy(st->slices[s].gradient + offset + lo, 1, st->slices[s + step].gradient + offset + lo, hi - lo);
+        }
+    }
+
+    kernels.axpy(target + lo, 1, st->slices[0].gradient + offset + lo, hi - lo);
+}
+
+internal void sync_step(Sync_Trainer *st, uint32_t t) {
+    RNA_Model *model = st->model;
+    size_t slices = (st->count + SYNC_SLICE_SIZE - 1) / SYNC_SLICE_SIZE;
+    for (size_t s = t; s < slices; s += st->threads) {
+        size_t first = s*SYNC_SLICE_SIZE;
+        size_t count = st->count - first < SYNC_SLICE_SIZE ? st->count - first : SYNC_SLICE_SIZE;
+        sync_compute_slice(st, &st->slices[s], st->first + first, count);
+    }
+
+    pthread_barrier_wait(&st->barrier);
+
+    // every value is reduced independently, so the workers split the buffers instead of the tree
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        size_t weights_offset = st->slices[0].weights[layer] - st->slices[0].gradient;
+        size_t biases_offset = st->slices[0].biases[layer] - st->slices[0].gradient;
+        size_t weights_len = (size_t) model->neuron_cnt[layer]*model->weights_stride[layer];
+        sync_reduce_range(st, t, slices, weights_offset, weights_len, model->weights[layer]);
+        sync_reduce_range(st, t, slices, biases_offset, model->neuron_cnt[layer], model->biases[layer]);
+    }
+
+    pthread_barrier_wait(&st->barrier);
+}
+
+internal void *_sync_worker(void *args) {
+    Sync_Worker *worker = (Sync_Worker *) args;
+    Sync_Trainer *st = worker->trainer;
+    for (;;) {
+        pthread_barrier_wait(&st->barrier);
+        if (st->done) {
+            break;
+        }
+
+        sync_step(st, worker->index);
+    }
+
+    return NULL;
+}
+
+internal void init_sync_trainer(Sync_Trainer *st, RNA_Model *model, uint32_t threads, size_t batch_size) {
+    *st = (Sync_Trainer) { .model = model, .threads = threads };
+    st->slice_cnt = (batch_size + SYNC_SLICE_SIZE - 1) / SYNC_SLICE_SIZE;
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        st->gradient_size += (size_t) model->neuron_cnt[layer]*(model->weights_stride[layer] + 1);
+    }
+
+    st->slices = malloc(sizeof(*st->slices) * st->slice_cnt);
+    assert(st->slices != NULL);
+    for (size_t s = 0; s < st->slice_cnt; s++) {
+        Sync_Slice *slice = &st->slices[s];
+        *slice = (Sync_Slice) { .ws = allocate_batch_workspace(model, SYNC_SLICE_SIZE) };
+        slice->gradient = aligned_alloc(MODEL_ALIGNMENT, ALIGN_UP(sizeof(Real) * st->gradient_size, MODEL_ALIGNMENT));
+        assert(slice->gradient != NULL);
+        slice->weights = malloc(sizeof(*slice->weights) * 2 * model->layer_count);
+        assert(slice->weights != NULL);
+        slice->biases = slice->weights + model->layer_count;
+
+        Real *cursor = slice->gradient;
+        for (size_t layer = 0; layer < model->layer_count; layer++) {
+            slice->weights[layer] = cursor;
+            cursor += (size_t) model->neuron_cnt[layer]*model->weights_stride[layer];
+            slice->biases[layer] = cursor;
+            cursor += model->neuron_cnt[layer];
+        }
+    }
+
+    pthread_barrier_init(&st->barrier, NULL, threads);
+    st->workers = malloc(sizeof(*st->workers) * threads);
+    assert(st->workers != NULL);
+    for (uint32_t t = 0; t < threads; t++) {
+        st->workers[t] = (Sync_Worker) { .trainer = st, .index = t };
+        if (t > 0) {
+            pthread_create(&st->workers[t].handle, NULL, _sync_worker, (void *) &st->workers[t]);
+        }
+    }
+}
+
+// Stops the workers and adds the timings of every slice to the model
+internal void denit_sync_trainer(Sync_Trainer *st) {
+    st->done = true;
+    pthread_barrier_wait(&st->barrier);
+    for (uint32_t t = 1; t < st->threads; t++) {
+        pthread_join(st->workers[t].handle, NULL);
+    }
+
+    pthread_barrier_destroy(&st->barrier);
+    for (size_t s = 0; s < st->slice_cnt; s++) {
+        Sync_Slice *slice = &st->slices[s];
+        st->model->forward_secs += slice->forward_secs;
+        st->model->backward_secs += slice->backward_secs;
+        free_batch_workspace(st->model, &slice->ws);
+        free(slice->gradient);
+        free(slice->weights);
+    }
+
+    free(st->slices);
+    free(st->workers);
+}
+
+// Trains the minibatch of `batch_size` samples of `chunk` starting at `first` and returns its size
+internal size_t train_sync_batch(Sync_Trainer *st, Data *chunk, size_t first, size_t batch_size, double *error) {
+    st->chunk = chunk;
+    st->first = first;
+    st->count = chunk->meta.size - first < batch_size ? chunk->meta.size - first : batch_size;
+    pthread_barrier_wait(&st->barrier);
+    sync_step(st, 0);
+
+    size_t slices = (st->count + SYNC_SLICE_SIZE - 1) / SYNC_SLICE_SIZE;
+    for (size_t s = 0; s < slices; s++) {
+        *error += st->slices[s].error;
+    }
+
+    return st->count;
+}
+
+static volatile sig_atomic_t stop_requested = false;
+
+void stop_training(void) {
+    stop_requested = true;
+}
+
+internal void publish_metrics(RNA_Model *model, Error error, double samples_per_sec) {
+    Telemetry *t = model->telemetry;
+    if (t == NULL) return;
+
+    size_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&t->tail, memory_order_acquire) == TELEMETRY_CAPACITY) {
+        atomic_fetch_add_explicit(&t->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    t->items[head % TELEMETRY_CAPACITY] = (Training_Metrics) {
+        .iteration = error.iteration,
+        .error = error.value,
+        .epoch = model->epoch,
+        .samples_per_sec = samples_per_sec,
+        .forward_secs = model->forward_secs,
+        .backward_secs = model->backward_secs,
+    };
+    atomic_store_explicit(&t->head, head + 1, memory_order_release);
+}
+
+bool poll_telemetry(Telemetry *t, Training_Metrics *metrics) {
+    size_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&t->head, memory_order_acquire)) {
+        return false;
+    }
+
+    *metrics = t->items[tail % TELEMETRY_CAPACITY];
+    atomic_store_explicit(&t->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+internal char *checkpoint_path(RNA_Model *model);
+internal void allocate_model(RNA_Model *model, const uint32_t *neuron_cnt, const uint32_t *weights_cnt, bool own_weights);
+
+// Checkpoints are written by a background thread: at a checkpoint the training thread only copies
+// the weights and its state into `snapshot` (a few memcpy) and goes on while the writer saves it
+typedef struct {
+    RNA_Model snapshot;
+    RNA_Parameters parameters;
+    char path[512 + 8];
+    pthread_t handle;
+    pthread_mutex_t lock;
+    pthread_cond_t done;       // signaled when `pending` changes or on `quit`
+    bool started;              // the snapshot and the thread are created by the first checkpoint
+    bool pending;              // `snapshot` holds a checkpoint not written yet
+    bool quit;
+} Checkpoint_Writer;
+
+internal void *_checkpoint_writer(void *args) {
+    Checkpoint_Writer *cw = (Checkpoint_Writer *) args;
+    pthread_mutex_lock(&cw->lock);
+    for (;;) {
+        while (!cw->pending && !cw->quit) {
+            pthread_cond_wait(&cw->done, &cw->lock);
+        }
+
+        if (!cw->pending) break;
+        pthread_mutex_unlock(&cw->lock);
+        save_checkpoint(&cw->snapshot, cw->path);
+        pthread_mutex_lock(&cw->lock);
+        cw->pending = false;
+        pthread_cond_broadcast(&cw->done);
+    }
+
+    pthread_mutex_unlock(&cw->lock);
+    return NULL;
+}
+
+// Snapshots `model` for the writer. When the previous checkpoint is still being written it is
+// skipped unless `wait` is set, so a slow disk never stalls training
+internal bool submit_checkpoint(Checkpoint_Writer *cw, RNA_Model *model, const char *path, bool wait) {
+    if (!cw->started) {
+        cw->snapshot = (RNA_Model) { .layer_count = model->layer_count, .training_parameters = &cw->parameters };
+        allocate_model(&cw->snapshot, model->neuron_cnt, model->weights_cnt, true);
+        pthread_mutex_init(&cw->lock, NULL);
+        pthread_cond_init(&cw->done, NULL);
+        pthread_create(&cw->handle, NULL, _checkpoint_writer, (void *) cw);
+        cw->started = true;
+    }
+
+    pthread_mutex_lock(&cw->lock);
+    if (cw->pending && !wait) {
+        pthread_mutex_unlock(&cw->lock);
+        fprintf(stderr, "WARNING: previous checkpoint is still being written, skipping this one\n");
+        return false;
+    }
+
+    while (cw->pending) {
+        pthread_cond_wait(&cw->done, &cw->lock);
+    }
+
+    RNA_Model *snapshot = &cw->snapshot;
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        memcpy(snapshot->weights[layer], model->weights[layer], sizeof(Real) * model->neuron_cnt[layer] * model->weights_stride[layer]);
+        memcpy(snapshot->biases[layer], model->biases[layer], sizeof(Real) * model->neuron_cnt[layer]);
+    }
+
+    // the snapshot history grows along with the model one, a checkpoint only copies it
+    Error_Hist *hist = &snapshot->error_hist;
+    if (hist->capacity < model->error_hist.count) {
+        hist->capacity = model->error_hist.capacity;
+        hist->items = realloc(hist->items, sizeof(*hist->items) * hist->capacity);
+        assert(hist->items != NULL);
+    }
+
+    if (model->error_hist.count > 0) {
+        memcpy(hist->items, model->error_hist.items, sizeof(*hist->items) * model->error_hist.count);
+    }
+    hist->count = model->error_hist.count;
+
+    snapshot->rng = model->rng;
+    snapshot->cursor = model->cursor;
+    cw->parameters = *model->training_parameters;
+    snprintf(cw->path, sizeof(cw->path), "%s", path);
+    cw->pending = true;
+    pthread_cond_broadcast(&cw->done);
+    pthread_mutex_unlock(&cw->lock);
+    return true;
+}
+
+// Waits for the checkpoint being written, if any
+internal void denit_checkpoint_writer(Checkpoint_Writer *cw) {
+    if (!cw->started) return;
+    pthread_mutex_lock(&cw->lock);
+    cw->quit = true;
+    pthread_cond_broadcast(&cw->done);
+    pthread_mutex_unlock(&cw->lock);
+    pthread_join(cw->handle, NULL);
+    pthread_mutex_destroy(&cw->lock);
+    pthread_cond_destroy(&cw->done);
+    free(cw->snapshot.error_hist.items);
+    denit_model(&cw->snapshot);
+    cw->started = false;
+}
+
+// Returns false when the training data could not be read, the model is then left half trained
+internal bool _train_model(RNA_Model *model, Data *training_data) {
+    bool status = true;
+    model->training = true;
+    // a stop requested while no training was running is not meant for this one
+    stop_requested = false;
+    model->interrupted = false;
+
+    if (training_data->_stream != NULL) {
+        rewind_data_stream(training_data->_stream);
+    }
+
+    uint32_t threads = model->training_parameters->threads > 0 ? model->training_parameters->threads : 1;
+    if (model->training_parameters->threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? cores : 1;
+    }
+
+    if (threads > MAX_TRAIN_THREADS) {
+        threads = MAX_TRAIN_THREADS;
+    }
+
+    size_t batch_size = model->training_parameters->batch_size > 1 ? model->training_parameters->batch_size : 1;
+
+    // a single worker reports after every batch as before, Hogwild ones meet once every
+    // ERROR_VALIDATION_STEP samples to merge their errors into `error_hist`
+    bool sync = model->training_parameters->sync;
+    size_t round = batch_size;
+    if (threads > 1 && !sync) {
+        round = ALIGN_UP((ERROR_VALIDATION_STEP + threads - 1) / threads, batch_size);
+    }
+
+    Sync_Trainer sync_trainer;
+    uint32_t worker_cnt = sync ? 0 : threads;
+
+    // per-sample steps on resident data train layer 0 on the nonzero pixels only, the shadow
+    // models below share `_columns` with the trained one
+    if (!sync && batch_size == 1 && training_data->_stream == NULL && model->weights_cnt[0] <= UINT16_MAX + 1) {
+        build_sparse_index(training_data);
+        size_t column_stride = ALIGN_UP(model->neuron_cnt[0], MODEL_ALIGNMENT / sizeof(Real));
+        model->_columns = aligned_alloc(MODEL_ALIGNMENT, sizeof(Real) * column_stride * model->weights_cnt[0]);
+        assert(model->_columns != NULL);
+        columns_from_rows(model);
+    }
+
+    Train_Worker *workers = malloc(sizeof(*workers) * worker_cnt);
+    assert(worker_cnt == 0 || workers != NULL);
+    for (uint32_t t = 0; t < worker_cnt; t++) {
+        init_train_worker(&workers[t], model, t > 0, batch_size);
+    }
+
+    if (sync) {
+        init_sync_trainer(&sync_trainer, model, threads, batch_size);
+    }
+
+    Checkpoint_Writer checkpoint_writer = {0};
+    Training_Cursor *cursor = &model->cursor;
+    uint32_t shards = sync ? 1 : threads;
+    bool resuming = cursor->resume;
+    cursor->resume = false;
+    if (!resuming) {
+        *cursor = (Training_Cursor) {0};
+        DA_APPEND(model->error_hist, ((Error) { .iteration = 0, .value = 1.0 }));
+    } else if (cursor->round != round || cursor->shards != shards) {
+        fprintf(stderr, "WARNING: checkpoint was taken with another batch size or thread count, restarting epoch %d\n", cursor->epoch + 1);
+        cursor->samples = cursor->chunk_first = cursor->offset = 0;
+    }
+    cursor->round = round;
+    cursor->shards = shards;
+
+    double global_error = cursor->error_sum;
+    // iterations count the samples of every epoch, they outgrow an int on long runs
+    size_t last_validation = cursor->last_validation;
+    size_t checkpoint_every = model->training_parameters->checkpoint_every;
+    size_t last_checkpoint = training_data->meta.size*(size_t) cursor->epoch + cursor->samples;
+    // half of the ring is left for the reports sent before the consumer starts polling
+    size_t replay_first = model->error_hist.count > TELEMETRY_REPLAY ? model->error_hist.count - TELEMETRY_REPLAY : 0;
+    for (size_t e = replay_first; e < model->error_hist.count; e++) {
+        publish_metrics(model, model->error_hist.items[e], 0.);
+    }
+
+    double last_report = now_secs();
+    size_t last_report_it = last_checkpoint;
+    for (int it = cursor->epoch; it < model->training_parameters->max_iters; it++) {
+        model->epoch = it + 1;
+        size_t i = resuming ? cursor->samples : 0;
+        size_t chunk_first = 0;
+        Data chunk;
+        while (next_chunk(training_data, &chunk, chunk_first)) {
+            size_t j = 0;
+            if (resuming) {
+                // streamed chunks before the checkpoint are read again but not trained on
+                if (chunk_first < cursor->chunk_first) {
+                    chunk_first += chunk.meta.size;
+                    continue;
+                }
+
+                j = cursor->offset;
+                resuming = false;
+            }
+
+            size_t shard = sync ? chunk.meta.size : (chunk.meta.size + threads - 1) / threads;
+            for (; j < shard; j += round) {
+                i += sync
+                    ? train_sync_batch(&sync_trainer, &chunk, j, batch_size, &global_error)
+                    : train_round(workers, threads, &chunk, j, round, &global_error);
+
+                // check error sum each ERROR_VALIDATION_STEP iterations
+                size_t input_it = training_data->meta.size*(size_t) it + i;
+                if (input_it / ERROR_VALIDATION_STEP > last_validation / ERROR_VALIDATION_STEP) {
+                    global_error /= input_it - last_validation;
+                    last_validation = input_it;
+                    printf("INFO: iteration: %zu error: %f\n", input_it, global_error);
+                    Error point = { .iteration = input_it, .value = global_error };
+                    DA_APPEND(model->error_hist, point);
+                    double now = now_secs();
+                    publish_metrics(model, point, (double) (input_it - last_report_it) / (now - last_report));
+                    last_report = now;
+                    last_report_it = input_it;
+                    if (global_error < model->training_parameters->tolerance) {
+                        goto CLEAN_UP;
+                    }
+                    global_error = 0.;
+                }
+
+                cursor->epoch = it;
+                cursor->samples = i;
+                cursor->chunk_first = chunk_first;
+                cursor->offset = j + round;
+                cursor->last_validation = last_validation;
+                cursor->error_sum = global_error;
+
+                bool checkpoint_due = checkpoint_every > 0 && input_it / checkpoint_every > last_checkpoint / checkpoint_every;
+                if (checkpoint_due || stop_requested) {
+                    if (model->_columns != NULL) {
+                        rows_from_columns(model);
+                    }
+
+                    submit_checkpoint(&checkpoint_writer, model, checkpoint_path(model), stop_requested);
+                    last_checkpoint = input_it;
+                }
+
+                if (stop_requested) {
+                    printf("INFO: training interrupted at iteration %zu\n", input_it);
+                    model->interrupted = true;
+                    goto CLEAN_UP;
+                }
+            }
+
+            chunk_first += chunk.meta.size;
+        }
+
+        // a failed read ends the epoch early, training on would skip the rest of the data
+        if (training_data->_stream != NULL && data_stream_failed(training_data->_stream)) {
+            fprintf(stderr, "ERROR: could not read the training data of epoch %d, stopping training\n", it + 1);
+            status = false;
+            goto CLEAN_UP;
+        }
+    }
+
+    // a finished run resumes as finished
+    cursor->epoch = model->training_parameters->max_iters;
+    cursor->samples = cursor->chunk_first = cursor->offset = 0;
+
+CLEAN_UP:
+    denit_checkpoint_writer(&checkpoint_writer);
+    for (uint32_t t = 0; t < worker_cnt; t++) {
+        denit_train_worker(&workers[t], model);
+    }
+
+    free(workers);
+    if (sync) {
+        denit_sync_trainer(&sync_trainer);
+    }
+
+    if (model->_columns != NULL) {
+        rows_from_columns(model);
+        free(model->_columns);
+        model->_columns = NULL;
+    }
+
+    stop_requested = false;
+    model->training = false;
+    return status;
+}
+
+typedef struct {
+    RNA_Model *model;
+    Data *training_data;
+} Thread_Args;
+
+internal void* _train_model_async(void *args) {
+    Thread_Args *td = (Thread_Args *) args;
+    // an interrupted run is not saved under the final name, its checkpoint holds the weights
+    if (train_model(td->model, td->training_data) && !td->model->interrupted) {
+        save_model(td->model);
+    }
+    return NULL;
+}
+
+void train_model_async(RNA_Model *model, Data *training_data) {
+    static pthread_t handle;
+    static Thread_Args args;
+    args.model = model;
+    args.training_data = training_data;
+    model->training = true;
+    pthread_create(&handle, NULL, _train_model_async, (void *)&args);
+    pthread_detach(handle);
+}
+
+void print_parameters(RNA_Parameters parameters) {
+    printf("+---------------------+\n");
+    printf("| Training Parameters |\n");
+    printf("+------------+--------+\n");
+    printf("| Tolerance  | %.4f |\n", parameters.tolerance);
+    printf("| LR         | %.4f |\n", parameters.lr);
+    printf("| Max Iters  |   %04d |\n", parameters.max_iters);
+    printf("| Batch Size |   %04d |\n", parameters.batch_size);
+    printf("| Threads    |   %04d |\n", parameters.threads);
+    printf("| Sync       | %6s |\n", parameters.sync ? "yes" : "no");
+    printf("+------------+--------+\n");
+}
+
+// xorshift64*, its whole state is `model->rng` so checkpoints can store it
+internal double rand_w(RNA_Model *model, float min, float max) {
+    model->rng ^= model->rng >> 12;
+    model->rng ^= model->rng << 25;
+    model->rng ^= model->rng >> 27;
+    uint32_t r = (model->rng * 0x2545F4914F6CDD1DULL) >> 32;
+    return min + (float) (r / 4294967296.0) * (max - min);
+}
+
+bool train_model(RNA_Model *model, Data *training_data) {
+    bool resume = model->cursor.resume;
+    if (!resume) {
+        model->error_hist.count = 0;
+        model->epoch = 0;
+        DA_APPEND(model->error_hist, ((Error) { .iteration = 1, .value = 1.0 }));
+    }
+
+    model->forward_secs = 0;
+    model->backward_secs = 0;
+
+    if (model->training_parameters->config_path != NULL &&
+        !read_parameters_from_file(model->training_parameters->config_path, model->training_parameters)
+    ) {
+        fprintf(stderr, "ERROR: parameters could not be readed from file, stopping training...\n");
+        return false;
+    }
+
+    print_parameters(*model->training_parameters);
+
+    bool warm_start = model->training_parameters->warm_start;
+    if (resume) {
+        printf("INFO: resuming training at epoch %d, sample %zu\n", model->cursor.epoch + 1, model->cursor.samples);
+    } else if (warm_start) {
+        printf("INFO: training from the current weights\n");
+    } else if (model->rng == 0) {
+        model->rng = ((uint64_t) rand() << 31 ^ (uint64_t) rand()) | 1;
+    }
+
+    for (size_t i = 0; !resume && !warm_start && i < model->layer_count; i++) {
+        size_t neuron_cnt = model->neuron_cnt[i];
+        memset(model->errors[i], 0, sizeof(*model->errors[i]) * neuron_cnt);
+        for (size_t neuron = 0; neuron < neuron_cnt; neuron++) {
+            Real *weights = get_neuron_weights(model, i, neuron);
+            for (size_t w = 0; w < model->weights_cnt[i]; w++) {
+                weights[w] = rand_w(model, -0.5, 0.5);
+            }
+
+            model->biases[i][neuron] = rand_w(model, -0.5, 0.5);
+        }
+    }
+
+    struct timespec start, end;
+    assert(clock_gettime(CLOCK_MONOTONIC, &start) >= 0);
+    bool status = _train_model(model, training_data);
+    assert(clock_gettime(CLOCK_MONOTONIC, &end) >= 0);
+    if (!status) {
+        return false;
+    }
+
+    float start_sec = start.tv_sec + start.tv_nsec/10e9;
+    float end_sec = end.tv_sec + end.tv_nsec/10e9;
+    float diff_in_secs = end_sec - start_sec;
+    if (model->interrupted) {
+        printf("INFO: training stopped, resume it from checkpoint %s\n", checkpoint_path(model));
+    } else {
+        printf("INFO: training finished\n");
+    }
+
+    printf("INFO: total training time: %.3f secs\n", diff_in_secs);
+    return true;
+}
+
+// Entry of `kernels.topologies` with the shape of `model`, if any
+internal const Topology_Kernels *find_topology(RNA_Model *model) {
+    if (kernels.topologies == NULL || model->layer_count != TOPOLOGY_LAYERS) return NULL;
+
+    for (size_t t = 0; t < TOPOLOGY_COUNT; t++) {
+        const Topology_Kernels *topology = &kernels.topologies[t];
+        bool match = model->weights_cnt[0] == topology->inputs;
+        for (size_t layer = 0; layer < TOPOLOGY_LAYERS; layer++) {
+            match = match && model->neuron_cnt[layer] == topology->neurons[layer]
+                          && model->weights_stride[layer] == TOPOLOGY_STRIDE(model->weights_cnt[layer])
+                          && (layer == 0 || model->weights_cnt[layer] == topology->neurons[layer - 1]);
+        }
+
+        if (match) return topology;
+    }
+
+    return NULL;
+}
+
+// Lays every buffer of the model out in one zeroed MODEL_ALIGNMENT aligned arena: the per layer
+// tables first, then for each layer its weight rows (padded to `weights_stride`), biases, values
+// and errors. `neuron_cnt` and `weights_cnt` are copied, so they may point to temporary storage.
+// Without `own_weights` the weights and biases are left NULL for the caller to point somewhere else
+internal void allocate_model(RNA_Model *model, const uint32_t *neuron_cnt, const uint32_t *weights_cnt, bool own_weights) {
+    const size_t row_align = MODEL_ALIGNMENT / sizeof(Real);
+    uint32_t layer_cnt = model->layer_count;
+    size_t arena_size = ALIGN_UP(sizeof(Real *) * 4 * layer_cnt, MODEL_ALIGNMENT)
+                      + ALIGN_UP(sizeof(uint32_t) * 3 * layer_cnt, MODEL_ALIGNMENT);
+    for (size_t layer = 0; layer < layer_cnt; layer++) {
+        size_t stride = ALIGN_UP(weights_cnt[layer], row_align);
+        if (own_weights) {
+            arena_size += ALIGN_UP(sizeof(Real) * stride * neuron_cnt[layer], MODEL_ALIGNMENT);
+            arena_size += ALIGN_UP(sizeof(Real) * neuron_cnt[layer], MODEL_ALIGNMENT);
+        }
+        arena_size += 2 * ALIGN_UP(sizeof(Real) * neuron_cnt[layer], MODEL_ALIGNMENT);
+    }
+
+    model->_arena = aligned_alloc(MODEL_ALIGNMENT, arena_size);
+    assert(model->_arena != NULL);
+    memset(model->_arena, 0, arena_size);
+
+    uint8_t *cursor = model->_arena;
+    Real **tables = arena_take(&cursor, sizeof(Real *) * 4 * layer_cnt);
+    model->weights = tables;
+    model->biases = tables + layer_cnt;
+    model->values = tables + 2*layer_cnt;
+    model->errors = tables + 3*layer_cnt;
+
+    uint32_t *counts = arena_take(&cursor, sizeof(uint32_t) * 3 * layer_cnt);
+    model->weights_cnt = counts;
+    model->weights_stride = counts + layer_cnt;
+    memcpy(model->weights_cnt, weights_cnt, sizeof(uint32_t) * layer_cnt);
+    model->neuron_cnt = memcpy(counts + 2*layer_cnt, neuron_cnt, sizeof(uint32_t) * layer_cnt);
+
+    for (size_t layer = 0; layer < layer_cnt; layer++) {
+        uint32_t neurons = model->neuron_cnt[layer];
+        model->weights_stride[layer] = ALIGN_UP(model->weights_cnt[layer], row_align);
+        if (own_weights) {
+            model->weights[layer] = arena_take(&cursor, sizeof(Real) * model->weights_stride[layer] * neurons);
+            model->biases[layer] = arena_take(&cursor, sizeof(Real) * neurons);
+        }
+        model->values[layer] = arena_take(&cursor, sizeof(Real) * neurons);
+        model->errors[layer] = arena_take(&cursor, sizeof(Real) * neurons);
+    }
+
+    assert((size_t) (cursor - (uint8_t *) model->_arena) == arena_size);
+    model->_topology = find_topology(model);
+}
+
+internal char *concat_path(char *dir, char *file) {
+    assert(file != NULL);
+    if (dir == NULL) return file;
+    int dir_len = strlen(dir) + 1;
+    assert(dir_len < 512 - 1 && "directory name is too big");
+    static char buffer[512];
+    memcpy(buffer, dir, dir_len);
+    buffer[dir_len-1] = '/';
+    strncpy(buffer + dir_len, file, 512 - dir_len);
+    return buffer;
+}
+
+#define WEIGHTS_IO_CHUNK 1024
+
+// v1 files store doubles, float builds convert them while reading
+internal bool read_weights(FILE *f, Real *weights, size_t cnt) {
+    if (sizeof(Real) == sizeof(double)) {
+        return fread(weights, sizeof(double), cnt, f) == cnt;
+    }
+
+    double buffer[WEIGHTS_IO_CHUNK];
+    for (size_t done = 0; done < cnt; done += WEIGHTS_IO_CHUNK) {
+        size_t n = cnt - done < WEIGHTS_IO_CHUNK ? cnt - done : WEIGHTS_IO_CHUNK;
+        if (fread(buffer, sizeof(double), n, f) != n) {
+            return false;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            weights[done + i] = buffer[i];
+        }
+    }
+
+    return true;
+}
+
+static const char magic[] = "JRNA";
+
+// JRNA v1: magic, layer count, then for every layer its neuron and weights count followed by its
+// rows of doubles, each one with the bias at the end.
+//
+// JRNA v2: a Model_File_Header, the section table (one Model_File_Section per layer) and the
+// weights and biases of every layer as MODEL_ALIGNMENT aligned blobs laid out exactly like the
+// model arena, so `map_model` can point the model straight into the file
+#define MODEL_FILE_VERSION 2
+#define MODEL_DTYPE_F64 1
+#define MODEL_DTYPE_F32 2
+#define MODEL_DTYPE_I8 3  // quantized weights, float biases, see `save_quantized_model`
+#define MODEL_LAYOUT_PADDED_ROWS 1 // rows of `weights_stride` values, biases in their own blob
+#define MODEL_LAYOUT_ROW_SCALES 2  // a blob of one float scale per row right after the biases blob
+
+#ifdef RNA_FLOAT32
+#define MODEL_DTYPE MODEL_DTYPE_F32
+#else
+#define MODEL_DTYPE MODEL_DTYPE_F64
+#endif
+
+typedef struct {
+    char magic[4];             // "JRNA"
+    uint32_t v1_marker;        // always 0, v1 files have their (non zero) layer count here
+    uint32_t version;
+    uint32_t dtype;            // MODEL_DTYPE_*
+    uint32_t layout;           // MODEL_LAYOUT_* flags
+    uint32_t layer_count;
+    uint64_t sections_offset;
+    uint64_t data_offset;      // first blob
+    uint64_t file_size;
+    uint64_t sections_checksum;
+    uint64_t data_checksum;    // every byte from `data_offset` to the end of the file
+} Model_File_Header;
+
+typedef struct {
+    uint32_t neuron_cnt;
+    uint32_t weights_cnt;
+    uint32_t weights_stride;   // values per row of the weights blob
+    uint32_t reserved;
+    uint64_t weights_offset;   // neuron_cnt x weights_stride values
+    uint64_t biases_offset;    // neuron_cnt values
+} Model_File_Section;
+
+// FNV-1a over 64 bit words, every checksummed range is a multiple of 8 bytes
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL
+internal uint64_t checksum64(uint64_t hash, const void *data, size_t size) {
+    const uint64_t *words = data;
+    for (size_t i = 0; i < size/sizeof(*words); i++) {
+        hash = (hash ^ words[i]) * 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+// Writes `size` bytes and pads them with zeros up to MODEL_ALIGNMENT, hashing all of it
+internal bool write_blob(FILE *f, const void *data, size_t size, uint64_t *hash) {
+    static const uint8_t zeros[MODEL_ALIGNMENT];
+    size_t padding = ALIGN_UP(size, MODEL_ALIGNMENT) - size;
+    *hash = checksum64(*hash, data, size);
+    *hash = checksum64(*hash, zeros, padding);
+    return fwrite(data, 1, size, f) == size && fwrite(zeros, 1, padding, f) == padding;
+}
+
+// Writes the model at the start of `f` and leaves the file positioned at its end
+internal bool write_model(FILE *f, const char *out, RNA_Model *model) {
+    Model_File_Section *sections = NULL;
+    bool ok = false;
+    size_t sections_size = sizeof(*sections) * model->layer_count;
+    sections = malloc(sections_size);
+    assert(sections != NULL);
+
+    Model_File_Header header = {
+        .version = MODEL_FILE_VERSION,
+        .dtype = MODEL_DTYPE,
+        .layout = MODEL_LAYOUT_PADDED_ROWS,
+        .layer_count = model->layer_count,
+        .sections_offset = ALIGN_UP(sizeof(header), MODEL_ALIGNMENT),
+    };
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.data_offset = ALIGN_UP(header.sections_offset + sections_size, MODEL_ALIGNMENT);
+
+    // blobs first, the header and the section table are written once their checksums are known
+    if (fseek(f, header.data_offset, SEEK_SET) != 0) {
+        LOG_WRITE_ERROR(out);
+        goto ERROR;
+    }
+
+    uint64_t offset = header.data_offset;
+    header.data_checksum = CHECKSUM_SEED;
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        uint32_t neurons = model->neuron_cnt[layer];
+        size_t weights_size = sizeof(Real) * neurons * model->weights_stride[layer];
+        size_t biases_size = sizeof(Real) * neurons;
+        sections[layer] = (Model_File_Section) {
+            .neuron_cnt = neurons,
+            .weights_cnt = model->weights_cnt[layer],
+            .weights_stride = model->weights_stride[layer],
+            .weights_offset = offset,
+            .biases_offset = offset + ALIGN_UP(weights_size, MODEL_ALIGNMENT),
+        };
+        offset = sections[layer].biases_offset + ALIGN_UP(biases_size, MODEL_ALIGNMENT);
+
+        if (!write_blob(f, model->weights[layer], weights_size, &header.data_checksum) ||
+            !write_blob(f, model->biases[layer], biases_size, &header.data_checksum)
+        ) {
+            LOG_WRITE_ERROR(out);
+            goto ERROR;
+        }
+    }
+
+    header.file_size = offset;
+    header.sections_checksum = checksum64(CHECKSUM_SEED, sections, sections_size);
+    if (fseek(f, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fseek(f, header.sections_offset, SEEK_SET) != 0 ||
+        fwrite(sections, sections_size, 1, f) != 1 ||
+        fseek(f, header.file_size, SEEK_SET) != 0
+    ) {
+        LOG_WRITE_ERROR(out);
+        goto ERROR;
+    }
+
+    ok = true;
+ERROR:
+    free(sections);
+    return ok;
+}
+
+internal bool dump_model(char *out, RNA_Model *model) {
+    FILE *f = fopen(out, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", out);
+        return false;
+    }
+
+    bool ok = write_model(f, out, model);
+    if (fclose(f) != 0 && ok) {
+        LOG_WRITE_ERROR(out);
+        ok = false;
+    }
+
+    return ok;
+}
+
+internal bool load_model_v1(FILE *f, char *in, RNA_Model *model) {
+    uint32_t *shapes = NULL;
+    bool status = false;
+
+    // the arena is sized from the layer shapes, so they are read first and the weights in a second pass
+    long weights_start = ftell(f);
+    shapes = malloc(sizeof(*shapes) * 2 * model->layer_count);
+    assert(shapes != NULL);
+    uint32_t *neuron_cnt = shapes;
+    uint32_t *weights_cnt = shapes + model->layer_count;
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        if (fread(&neuron_cnt[layer], sizeof(neuron_cnt[layer]), 1, f) == 0) {
+            LOG_READ_ERROR("neuron count", in);
+            goto ERROR;
+        }
+
+        if (fread(&weights_cnt[layer], sizeof(weights_cnt[layer]), 1, f) == 0) {
+            LOG_READ_ERROR("weights count", in);
+            goto ERROR;
+        }
+
+        // + 1 for bias
+        long total_weights = (long) (weights_cnt[layer] + 1) * neuron_cnt[layer];
+        if (fseek(f, total_weights*sizeof(double), SEEK_CUR) != 0) {
+            LOG_READ_ERROR("weights", in);
+            goto ERROR;
+        }
+    }
+
+    allocate_model(model, neuron_cnt, weights_cnt, true);
+    if (fseek(f, weights_start, SEEK_SET) != 0) {
+        LOG_READ_ERROR("weights", in);
+        goto ERROR;
+    }
+
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        if (fseek(f, sizeof(neuron_cnt[layer]) + sizeof(weights_cnt[layer]), SEEK_CUR) != 0) {
+            LOG_READ_ERROR("weights", in);
+            goto ERROR;
+        }
+
+        for (size_t neuron = 0; neuron < model->neuron_cnt[layer]; neuron++) {
+            if (!read_weights(f, get_neuron_weights(model, layer, neuron), model->weights_cnt[layer]) ||
+                !read_weights(f, &model->biases[layer][neuron], 1)
+            ) {
+                LOG_READ_ERROR("weights", in);
+                goto ERROR;
+            }
+        }
+    }
+
+    status = true;
+ERROR:
+    free(shapes);
+    return status;
+}
+
+// Copies `cnt` values of the given dtype into `dst`, converting them to `Real`
+internal void copy_values(Real *dst, const void *src, uint32_t dtype, size_t cnt) {
+    if (dtype == MODEL_DTYPE) {
+        memcpy(dst, src, sizeof(Real) * cnt);
+    } else if (dtype == MODEL_DTYPE_F64) {
+        for (size_t i = 0; i < cnt; i++) dst[i] = ((const double *) src)[i];
+    } else {
+        for (size_t i = 0; i < cnt; i++) dst[i] = ((const float *) src)[i];
+    }
+}
+
+// Checks the header, the section table and the bounds of every blob of a mapped v2 file, returns
+// the section table or NULL. The blobs themselves are only covered by `header->data_checksum`
+internal Model_File_Section *check_model_v2(char *in, const uint8_t *content, size_t size, Model_File_Header *header) {
+    if (size < sizeof(*header)) {
+        LOG_READ_ERROR("header", in);
+        return NULL;
+    }
+    memcpy(header, content, sizeof(*header));
+
+    if (header->version != MODEL_FILE_VERSION) {
+        fprintf(stderr, "ERROR: model %s has version %u, only versions 1 and %d are supported\n", in, header->version, MODEL_FILE_VERSION);
+        return NULL;
+    }
+
+    bool real_model = (header->dtype == MODEL_DTYPE_F64 || header->dtype == MODEL_DTYPE_F32) && header->layout == MODEL_LAYOUT_PADDED_ROWS;
+    bool quantized_model = header->dtype == MODEL_DTYPE_I8 && header->layout == (MODEL_LAYOUT_PADDED_ROWS | MODEL_LAYOUT_ROW_SCALES);
+    if (!real_model && !quantized_model) {
+        fprintf(stderr, "ERROR: model %s has an unknown dtype (%u) or layout (%u)\n", in, header->dtype, header->layout);
+        return NULL;
+    }
+
+    size_t sections_size = sizeof(Model_File_Section) * header->layer_count;
+    // checkpoints append their training state after the model, so the file can be larger
+    uint64_t model_size = header->file_size;
+    if (model_size > size || header->layer_count == 0 ||
+        header->sections_offset + sections_size > header->data_offset || header->data_offset > model_size ||
+        header->data_offset % MODEL_ALIGNMENT != 0
+    ) {
+        fprintf(stderr, "ERROR: model %s is truncated or its header is corrupted\n", in);
+        return NULL;
+    }
+
+    Model_File_Section *sections = (Model_File_Section *) (content + header->sections_offset);
+    if (checksum64(CHECKSUM_SEED, sections, sections_size) != header->sections_checksum) {
+        fprintf(stderr, "ERROR: section table checksum mismatch in model %s\n", in);
+        return NULL;
+    }
+
+    size_t value_size = header->dtype == MODEL_DTYPE_F64 ? sizeof(double) : header->dtype == MODEL_DTYPE_F32 ? sizeof(float) : sizeof(int8_t);
+    size_t bias_size = quantized_model ? sizeof(float) : value_size;
+    for (size_t layer = 0; layer < header->layer_count; layer++) {
+        Model_File_Section *section = &sections[layer];
+        uint64_t weights_size = (uint64_t) value_size * section->neuron_cnt * section->weights_stride;
+        // the scales of a quantized layer follow its biases, see MODEL_LAYOUT_ROW_SCALES
+        uint64_t biases_size = (uint64_t) bias_size * section->neuron_cnt;
+        if (quantized_model) biases_size = ALIGN_UP(biases_size, MODEL_ALIGNMENT) + biases_size;
+        if (section->weights_stride < section->weights_cnt ||
+            section->weights_offset % MODEL_ALIGNMENT != 0 || section->biases_offset % MODEL_ALIGNMENT != 0 ||
+            section->weights_offset < header->data_offset || section->weights_offset + weights_size > model_size ||
+            section->biases_offset < header->data_offset || section->biases_offset + biases_size > model_size
+        ) {
+            fprintf(stderr, "ERROR: layer %zu of model %s is out of bounds\n", layer, in);
+            return NULL;
+        }
+    }
+
+    return sections;
+}
+
+// Maps a v2 file and checks its header and section table. With `zero_copy`, when the file was
+// written by a build of the same precision, the weights and biases point into the mapping and the
+// blobs are not read at all until used. Otherwise the blobs are verified and copied into the arena
+internal bool load_model_v2(char *in, RNA_Model *model, bool zero_copy) {
+    size_t size;
+    uint8_t *content = map_file(in, &size);
+    uint32_t *shapes = NULL;
+    bool status = false;
+    if (content == NULL) {
+        goto ERROR;
+    }
+
+    Model_File_Header header;
+    Model_File_Section *sections = check_model_v2(in, content, size, &header);
+    if (sections == NULL) {
+        goto ERROR;
+    }
+
+    if (header.dtype == MODEL_DTYPE_I8) {
+        fprintf(stderr, "ERROR: model %s is int8 quantized, it only loads with `load_quantized_model`\n", in);
+        goto ERROR;
+    }
+
+    uint64_t model_size = header.file_size;
+    size_t value_size = header.dtype == MODEL_DTYPE_F64 ? sizeof(double) : sizeof(float);
+
+    model->layer_count = header.layer_count;
+    shapes = malloc(sizeof(*shapes) * 2 * model->layer_count);
+    assert(shapes != NULL);
     for (size_t layer = 0; layer < model->layer_count; layer++) {
-        if (fread(&model->neuron_cnt[layer], sizeof(model->neuron_cnt[layer]), 1, f) == 0) {
-            LOG_READ_ERROR("neuron count", in);
-            goto ERROR;
+        shapes[layer] = sections[layer].neuron_cnt;
+        shapes[model->layer_count + layer] = sections[layer].weights_cnt;
+    }
+
+    bool same_layout = header.dtype == MODEL_DTYPE;
+    for (size_t layer = 0; same_layout && layer < model->layer_count; layer++) {
+        same_layout = sections[layer].weights_stride == ALIGN_UP(sections[layer].weights_cnt, MODEL_ALIGNMENT / sizeof(Real));
+    }
+
+    if (zero_copy && same_layout) {
+        allocate_model(model, shapes, shapes + model->layer_count, false);
+        for (size_t layer = 0; layer < model->layer_count; layer++) {
+            model->weights[layer] = (Real *) (content + sections[layer].weights_offset);
+            model->biases[layer] = (Real *) (content + sections[layer].biases_offset);
         }
 
-        if (fread(&model->weights_cnt[layer], sizeof(model->weights_cnt[layer]), 1, f) == 0) {
-            LOG_READ_ERROR("weights count", in);
+        model->_mapped = content;
+        model->_mapped_size = size;
+        content = NULL;
+    } else {
+        if (checksum64(CHECKSUM_SEED, content + header.data_offset, model_size - header.data_offset) != header.data_checksum) {
+            fprintf(stderr, "ERROR: weights checksum mismatch in model %s\n", in);
             goto ERROR;
         }
 
-        model->values[layer] = malloc(sizeof(*model->values[layer]) * model->neuron_cnt[layer]);
-        assert(model->values[layer] != NULL);
+        allocate_model(model, shapes, shapes + model->layer_count, true);
+        for (size_t layer = 0; layer < model->layer_count; layer++) {
+            Model_File_Section *section = &sections[layer];
+            for (size_t neuron = 0; neuron < section->neuron_cnt; neuron++) {
+                const uint8_t *row = content + section->weights_offset + value_size*neuron*section->weights_stride;
+                copy_values(get_neuron_weights(model, layer, neuron), row, header.dtype, section->weights_cnt);
+            }
 
-        // + 1 for bias
-        uint32_t total_weights = (model->weights_cnt[layer] + 1) * model->neuron_cnt[layer];
-        model->weights[layer] = malloc(sizeof(double)*total_weights);
-        assert(model->weights[layer] != NULL);
-        if (fread(model->weights[layer], sizeof(double), total_weights, f) != total_weights) {
-            LOG_READ_ERROR("weights", in);
-            goto ERROR;
+            copy_values(model->biases[layer], content + section->biases_offset, header.dtype, section->neuron_cnt);
         }
     }
 
     status = true;
+ERROR:
+    free(shapes);
+    if (content) munmap(content, size);
+    return status;
+}
+
+internal bool open_model(char *in, RNA_Model *model, bool zero_copy) {
+    FILE *f = fopen(in, "rb");
+    bool status = false;
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", in);
+        goto ERROR;
+    }
+
+    static unsigned char magic_buffer[4];
+    if (fread(&magic_buffer, sizeof(magic_buffer), 1, f) == 0) {
+        LOG_READ_ERROR("magic value", in);
+        goto ERROR;
+    }
+
+    if (memcmp(magic, magic_buffer, 4) != 0) {
+        fprintf(stderr, "ERROR: first 4 bytes of file %s dont match magic constant %*s\n", in, 4, magic);
+        goto ERROR;
+    }
+
+    if (fread(&model->layer_count, sizeof(model->layer_count), 1, f) == 0) {
+        LOG_READ_ERROR("layer_count", in);
+        goto ERROR;
+    }
+
+    if (model->layer_count != 0) {
+        status = load_model_v1(f, in, model);
+    } else {
+        fclose(f);
+        f = NULL;
+        status = load_model_v2(in, model, zero_copy);
+    }
+
 ERROR:
     if(f) fclose(f);
     return status;
 }
 
-bool save_model(RNA_Model *model) {
-    char *path;
+bool load_model(char *in, RNA_Model *model) {
+    return open_model(in, model, false);
+}
+
+bool map_model(char *in, RNA_Model *model) {
+    return open_model(in, model, true);
+}
+
+internal char *model_path(RNA_Model *model) {
     if (model->training_parameters->output_path == NULL) {
         static char buffer[256];
         sprintf(buffer, "lr_%.4f-tl_%.4f-itrs_%d.model", model->training_parameters->lr, model->training_parameters->tolerance, model->training_parameters->max_iters);
-        path = concat_path(model->training_parameters->output_dir_path, buffer);
-        if (!dump_model(path, model)) {
-            fprintf(stderr, "ERROR: failed to save model\n");
-            return false;
-        }
+        return concat_path(model->training_parameters->output_dir_path, buffer);
+    }
+
+    return concat_path(model->training_parameters->output_dir_path, model->training_parameters->output_path);
+}
+
+internal char *checkpoint_path(RNA_Model *model) {
+    if (model->training_parameters->checkpoint_path != NULL) {
+        return model->training_parameters->checkpoint_path;
+    }
+
+    static char buffer[512 + 8];
+    snprintf(buffer, sizeof(buffer), "%s.ckpt", model_path(model));
+    return buffer;
+}
+
+bool save_model(RNA_Model *model) {
+    char *path = model_path(model);
+    if (!dump_model(path, model)) {
+        fprintf(stderr, "ERROR: failed to save model\n");
+        return false;
+    }
+
+    printf("INFO: saved model to file %s\n", path);
+    return true;
+}
+
+// A checkpoint is a JRNA v2 model followed by the state needed to resume its training: the
+// Checkpoint_State block and its `error_count` Error items
+#define CHECKPOINT_VERSION 2
+
+typedef struct {
+    char magic[4];             // "JCKP"
+    uint32_t version;
+    uint64_t rng;
+    uint64_t samples;          // Training_Cursor
+    uint64_t chunk_first;
+    uint64_t offset;
+    uint64_t round;
+    uint64_t last_validation;
+    double error_sum;
+    double lr;                 // RNA_Parameters, the paths are not stored
+    double tolerance;
+    uint64_t checkpoint_every;
+    uint64_t error_count;
+    uint64_t checksum;         // of this block (with `checksum` = 0) and the error history
+    uint32_t shards;
+    int32_t epoch;
+    int32_t max_iters;
+    int32_t batch_size;
+    int32_t threads;
+    int32_t sync;
+} Checkpoint_State;
+
+static const char checkpoint_magic[] = "JCKP";
+
+internal uint64_t checkpoint_checksum(Checkpoint_State state, const Error *errors) {
+    state.checksum = 0;
+    uint64_t hash = checksum64(CHECKSUM_SEED, &state, sizeof(state));
+    return checksum64(hash, errors, sizeof(*errors) * state.error_count);
+}
+
+// Written next to `path` and renamed over it, so an interrupted save keeps the previous checkpoint
+bool save_checkpoint(RNA_Model *model, const char *path) {
+    RNA_Parameters *parameters = model->training_parameters;
+    Training_Cursor *cursor = &model->cursor;
+    Checkpoint_State state = {
+        .version = CHECKPOINT_VERSION,
+        .rng = model->rng,
+        .samples = cursor->samples,
+        .chunk_first = cursor->chunk_first,
+        .offset = cursor->offset,
+        .round = cursor->round,
+        .error_sum = cursor->error_sum,
+        .lr = parameters->lr,
+        .tolerance = parameters->tolerance,
+        .error_count = model->error_hist.count,
+        .shards = cursor->shards,
+        .epoch = cursor->epoch,
+        .last_validation = cursor->last_validation,
+        .max_iters = parameters->max_iters,
+        .batch_size = parameters->batch_size,
+        .threads = parameters->threads,
+        .sync = parameters->sync,
+        .checkpoint_every = parameters->checkpoint_every,
+    };
+    memcpy(state.magic, checkpoint_magic, sizeof(state.magic));
+    state.checksum = checkpoint_checksum(state, model->error_hist.items);
+
+    char tmp_path[512 + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", tmp_path);
+        return false;
+    }
+
+    // the data reaches the disk before the rename, so the checkpoint at `path` is always complete
+    bool ok = write_model(f, tmp_path, model) &&
+        fwrite(&state, sizeof(state), 1, f) == 1 &&
+        fwrite(model->error_hist.items, sizeof(Error), state.error_count, f) == state.error_count &&
+        fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0 || !ok) {
+        LOG_WRITE_ERROR(tmp_path);
+        remove(tmp_path);
+        return false;
+    }
+
+    if (rename(tmp_path, path) != 0) {
+        fprintf(stderr, "ERROR: could not rename %s to %s: %s\n", tmp_path, path, strerror(errno));
+        remove(tmp_path);
+        return false;
+    }
+
+    // and the rename itself is made durable by syncing the directory
+    char dir[sizeof(tmp_path)];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
     } else {
-        path = concat_path(model->training_parameters->output_dir_path, model->training_parameters->output_path);
-        if (!dump_model(path, model)) {
-            fprintf(stderr, "ERROR: failed to save model\n");
-            return false;
+        slash[slash == dir] = '\0';
+    }
+
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    printf("INFO: saved checkpoint to file %s\n", path);
+    return true;
+}
+
+bool load_checkpoint(char *path, RNA_Model *model, RNA_Parameters *parameters) {
+    if (!load_model(path, model)) {
+        return false;
+    }
+
+    FILE *f = fopen(path, "rb");
+    Error *errors = NULL;
+    bool status = false;
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", path);
+        goto ERROR;
+    }
+
+    Model_File_Header header;
+    Checkpoint_State state;
+    if (fread(&header, sizeof(header), 1, f) != 1 || fseek(f, header.file_size, SEEK_SET) != 0 ||
+        fread(&state, sizeof(state), 1, f) != 1 || memcmp(state.magic, checkpoint_magic, sizeof(state.magic)) != 0
+    ) {
+        fprintf(stderr, "ERROR: %s is a model without training state, not a checkpoint\n", path);
+        goto ERROR;
+    }
+
+    if (state.version != CHECKPOINT_VERSION || state.error_count > UINT32_MAX) {
+        fprintf(stderr, "ERROR: checkpoint %s has an unsupported version (%u) or is corrupted\n", path, state.version);
+        goto ERROR;
+    }
+
+    errors = malloc(sizeof(*errors) * (state.error_count > 0 ? state.error_count : 1));
+    assert(errors != NULL);
+    if (fread(errors, sizeof(*errors), state.error_count, f) != state.error_count ||
+        checkpoint_checksum(state, errors) != state.checksum
+    ) {
+        fprintf(stderr, "ERROR: training state of checkpoint %s is truncated or corrupted\n", path);
+        goto ERROR;
+    }
+
+    if (parameters != NULL) {
+        parameters->lr = state.lr;
+        parameters->tolerance = state.tolerance;
+        parameters->max_iters = state.max_iters;
+        parameters->batch_size = state.batch_size;
+        parameters->threads = state.threads;
+        parameters->sync = state.sync;
+        parameters->checkpoint_every = state.checkpoint_every;
+    }
+
+    model->rng = state.rng;
+    model->cursor = (Training_Cursor) {
+        .epoch = state.epoch,
+        .samples = state.samples,
+        .chunk_first = state.chunk_first,
+        .offset = state.offset,
+        .round = state.round,
+        .shards = state.shards,
+        .last_validation = state.last_validation,
+        .error_sum = state.error_sum,
+        .resume = true,
+    };
+    model->epoch = state.epoch;
+    model->error_hist.count = 0;
+    for (size_t i = 0; i < state.error_count; i++) {
+        DA_APPEND(model->error_hist, errors[i]);
+    }
+
+    status = true;
+ERROR:
+    free(errors);
+    if (f) fclose(f);
+    if (!status) denit_model(model);
+    return status;
+}
+
+// int8 models: every row of weights is scaled by its largest magnitude into -127..127 and the
+// activations are stored as 0..127 (pixels halved, sigmoid outputs * 127), so the products summed in
+// pairs by pmaddubsw stay within 16 bits. Accumulation is exact in int32, and only the per-row
+// rescale, bias and sigmoid run in float
+#define Q8_MAX 127
+#define Q8_PIXEL_SCALE (2.0f/255.0f) // value of one step of a halved pixel
+#define Q8_ACTIVATION_SCALE (1.0f/Q8_MAX)
+
+internal void allocate_quantized_model(Quantized_Model *model, const uint32_t *neuron_cnt, const uint32_t *weights_cnt) {
+    uint32_t layer_cnt = model->layer_count;
+    size_t arena_size = ALIGN_UP(sizeof(void *) * 4 * layer_cnt, MODEL_ALIGNMENT)
+                      + ALIGN_UP(sizeof(uint32_t) * 3 * layer_cnt, MODEL_ALIGNMENT)
+                      + ALIGN_UP(weights_cnt[0], MODEL_ALIGNMENT)
+                      + ALIGN_UP(sizeof(float) * neuron_cnt[layer_cnt - 1], MODEL_ALIGNMENT);
+    uint32_t max_neurons = 0;
+    for (size_t layer = 0; layer < layer_cnt; layer++) {
+        max_neurons = neuron_cnt[layer] > max_neurons ? neuron_cnt[layer] : max_neurons;
+        arena_size += ALIGN_UP(weights_cnt[layer], MODEL_ALIGNMENT) * neuron_cnt[layer];
+        arena_size += 2 * ALIGN_UP(sizeof(float) * neuron_cnt[layer], MODEL_ALIGNMENT);
+        arena_size += ALIGN_UP(neuron_cnt[layer], MODEL_ALIGNMENT);
+    }
+    arena_size += ALIGN_UP(sizeof(int32_t) * max_neurons, MODEL_ALIGNMENT);
+
+    model->_arena = aligned_alloc(MODEL_ALIGNMENT, arena_size);
+    assert(model->_arena != NULL);
+    memset(model->_arena, 0, arena_size); // zero padding lets the kernels run over whole strides
+
+    uint8_t *cursor = model->_arena;
+    void **tables = arena_take(&cursor, sizeof(void *) * 4 * layer_cnt);
+    model->weights = (int8_t **) tables;
+    model->scales = (float **) (tables + layer_cnt);
+    model->biases = (float **) (tables + 2*layer_cnt);
+    model->values = (uint8_t **) (tables + 3*layer_cnt);
+
+    uint32_t *counts = arena_take(&cursor, sizeof(uint32_t) * 3 * layer_cnt);
+    model->weights_cnt = memcpy(counts, weights_cnt, sizeof(uint32_t) * layer_cnt);
+    model->weights_stride = counts + layer_cnt;
+    model->neuron_cnt = memcpy(counts + 2*layer_cnt, neuron_cnt, sizeof(uint32_t) * layer_cnt);
+    model->input = arena_take(&cursor, ALIGN_UP(weights_cnt[0], MODEL_ALIGNMENT));
+    model->output = arena_take(&cursor, ALIGN_UP(sizeof(float) * neuron_cnt[layer_cnt - 1], MODEL_ALIGNMENT));
+    model->sums = arena_take(&cursor, ALIGN_UP(sizeof(int32_t) * max_neurons, MODEL_ALIGNMENT));
+
+    for (size_t layer = 0; layer < layer_cnt; layer++) {
+        uint32_t neurons = neuron_cnt[layer];
+        model->weights_stride[layer] = ALIGN_UP(weights_cnt[layer], MODEL_ALIGNMENT);
+        model->weights[layer] = arena_take(&cursor, (size_t) model->weights_stride[layer] * neurons);
+        model->biases[layer] = arena_take(&cursor, ALIGN_UP(sizeof(float) * neurons, MODEL_ALIGNMENT));
+        model->scales[layer] = arena_take(&cursor, ALIGN_UP(sizeof(float) * neurons, MODEL_ALIGNMENT));
+        model->values[layer] = arena_take(&cursor, ALIGN_UP(neurons, MODEL_ALIGNMENT));
+    }
+
+    assert((size_t) (cursor - (uint8_t *) model->_arena) == arena_size);
+}
+
+void quantize_model(const RNA_Model *model, Quantized_Model *quantized) {
+    quantized->layer_count = model->layer_count;
+    allocate_quantized_model(quantized, model->neuron_cnt, model->weights_cnt);
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        for (size_t neuron = 0; neuron < model->neuron_cnt[layer]; neuron++) {
+            const Real *weights = model->weights[layer] + neuron*model->weights_stride[layer];
+            int8_t *row = quantized->weights[layer] + neuron*quantized->weights_stride[layer];
+            float max = 0;
+            for (size_t w = 0; w < model->weights_cnt[layer]; w++) {
+                max = fmaxf(max, fabsf((float) weights[w]));
+            }
+
+            float scale = max > 0 ? max / Q8_MAX : 1;
+            for (size_t w = 0; w < model->weights_cnt[layer]; w++) {
+                row[w] = (int8_t) lrintf((float) weights[w] / scale);
+            }
+
+            quantized->scales[layer][neuron] = scale;
+            quantized->biases[layer][neuron] = model->biases[layer][neuron];
         }
     }
+}
+
+int find_label_quantized(Quantized_Model *model, const uint8_t *pixels) {
+    // locals so the compiler knows the byte stores cannot alias the model and vectorizes the loop
+    uint8_t *input = model->input;
+    size_t input_cnt = model->weights_cnt[0];
+    for (size_t i = 0; i < input_cnt; i++) {
+        input[i] = pixels[i] >> 1;
+    }
 
+    const uint8_t *x = model->input;
+    float x_scale = Q8_PIXEL_SCALE;
+    size_t out_layer = model->layer_count - 1;
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        kernels.gemv_q8(model->neuron_cnt[layer], model->weights_stride[layer], model->weights[layer], model->weights_stride[layer], x, model->sums);
+        for (size_t neuron = 0; neuron < model->neuron_cnt[layer]; neuron++) {
+            float v = model->sums[neuron] * x_scale * model->scales[layer][neuron] + model->biases[layer][neuron];
+            v = .5f * (v / (1 + fabsf(v)) + 1);
+            if (layer == out_layer) {
+                model->output[neuron] = v;
+            } else {
+                model->values[layer][neuron] = (uint8_t) (v * Q8_MAX + .5f);
+            }
+        }
+
+        x = model->values[layer];
+        x_scale = Q8_ACTIVATION_SCALE;
+    }
+
+    int label = 0;
+    for (size_t out_neuron = 1; out_neuron < model->neuron_cnt[out_layer]; out_neuron++) {
+        if (model->output[out_neuron] > model->output[label]) {
+            label = out_neuron;
+        }
+    }
+
+    return label;
+}
+
+// JRNA v2 with MODEL_DTYPE_I8: int8 weight rows, then per layer a float biases blob followed by
+// a float scales blob (MODEL_LAYOUT_ROW_SCALES)
+bool save_quantized_model(const Quantized_Model *model, char *out) {
+    FILE *f = fopen(out, "wb");
+    Model_File_Section *sections = NULL;
+    bool ok = false;
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", out);
+        goto ERROR;
+    }
+
+    size_t sections_size = sizeof(*sections) * model->layer_count;
+    sections = malloc(sections_size);
+    assert(sections != NULL);
+
+    Model_File_Header header = {
+        .version = MODEL_FILE_VERSION,
+        .dtype = MODEL_DTYPE_I8,
+        .layout = MODEL_LAYOUT_PADDED_ROWS | MODEL_LAYOUT_ROW_SCALES,
+        .layer_count = model->layer_count,
+        .sections_offset = ALIGN_UP(sizeof(header), MODEL_ALIGNMENT),
+    };
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.data_offset = ALIGN_UP(header.sections_offset + sections_size, MODEL_ALIGNMENT);
+    if (fseek(f, header.data_offset, SEEK_SET) != 0) {
+        LOG_WRITE_ERROR(out);
+        goto ERROR;
+    }
+
+    uint64_t offset = header.data_offset;
+    header.data_checksum = CHECKSUM_SEED;
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        uint32_t neurons = model->neuron_cnt[layer];
+        size_t weights_size = (size_t) neurons * model->weights_stride[layer];
+        size_t floats_size = sizeof(float) * neurons;
+        sections[layer] = (Model_File_Section) {
+            .neuron_cnt = neurons,
+            .weights_cnt = model->weights_cnt[layer],
+            .weights_stride = model->weights_stride[layer],
+            .weights_offset = offset,
+            .biases_offset = offset + ALIGN_UP(weights_size, MODEL_ALIGNMENT),
+        };
+        offset = sections[layer].biases_offset + 2 * ALIGN_UP(floats_size, MODEL_ALIGNMENT);
+
+        if (!write_blob(f, model->weights[layer], weights_size, &header.data_checksum) ||
+            !write_blob(f, model->biases[layer], floats_size, &header.data_checksum) ||
+            !write_blob(f, model->scales[layer], floats_size, &header.data_checksum)
+        ) {
+            LOG_WRITE_ERROR(out);
+            goto ERROR;
+        }
+    }
+
+    header.file_size = offset;
+    header.sections_checksum = checksum64(CHECKSUM_SEED, sections, sections_size);
+    if (fseek(f, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fseek(f, header.sections_offset, SEEK_SET) != 0 ||
+        fwrite(sections, sections_size, 1, f) != 1
+    ) {
+        LOG_WRITE_ERROR(out);
+        goto ERROR;
+    }
+
+    ok = true;
+ERROR:
+    free(sections);
+    if (f && fclose(f) != 0 && ok) {
+        LOG_WRITE_ERROR(out);
+        ok = false;
+    }
+    return ok;
+}
+
+bool load_quantized_model(char *in, Quantized_Model *model) {
+    size_t size;
+    uint8_t *content = map_file(in, &size);
+    uint32_t *shapes = NULL;
+    bool status = false;
+    if (content == NULL) {
+        goto ERROR;
+    }
+
+    Model_File_Header header;
+    Model_File_Section *sections = check_model_v2(in, content, size, &header);
+    if (sections == NULL) {
+        goto ERROR;
+    }
+
+    if (header.dtype != MODEL_DTYPE_I8) {
+        fprintf(stderr, "ERROR: model %s is not quantized, use `quantize_model` on it\n", in);
+        goto ERROR;
+    }
+
+    if (checksum64(CHECKSUM_SEED, content + header.data_offset, header.file_size - header.data_offset) != header.data_checksum) {
+        fprintf(stderr, "ERROR: weights checksum mismatch in model %s\n", in);
+        goto ERROR;
+    }
+
+    // the activations of a layer are the input of the next one, with the same padding
+    for (size_t layer = 1; layer < header.layer_count; layer++) {
+        if (sections[layer].weights_cnt != sections[layer - 1].neuron_cnt) {
+            fprintf(stderr, "ERROR: layer %zu of model %s does not take the outputs of the previous one\n", layer, in);
+            goto ERROR;
+        }
+    }
+
+    model->layer_count = header.layer_count;
+    shapes = malloc(sizeof(*shapes) * 2 * model->layer_count);
+    assert(shapes != NULL);
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        shapes[layer] = sections[layer].neuron_cnt;
+        shapes[model->layer_count + layer] = sections[layer].weights_cnt;
+    }
+
+    allocate_quantized_model(model, shapes, shapes + model->layer_count);
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        Model_File_Section *section = &sections[layer];
+        for (size_t neuron = 0; neuron < section->neuron_cnt; neuron++) {
+            memcpy(model->weights[layer] + neuron*model->weights_stride[layer],
+                   content + section->weights_offset + neuron*section->weights_stride, section->weights_cnt);
+        }
+
+        size_t floats_size = sizeof(float) * section->neuron_cnt;
+        memcpy(model->biases[layer], content + section->biases_offset, floats_size);
+        memcpy(model->scales[layer], content + section->biases_offset + ALIGN_UP(floats_size, MODEL_ALIGNMENT), floats_size);
+    }
+
+    status = true;
+ERROR:
+    free(shapes);
+    if (content) munmap(content, size);
+    return status;
+}
+
+void denit_quantized_model(Quantized_Model *model) {
+    free(model->_arena);
+    model->_arena = NULL;
+}
+
+// C source export: `<out>.h` declares the forward pass, `<out>.c` holds it with the weights as
+// static arrays. The weights are stored by input (transposed), so each layer is a sweep of
+// contiguous axpys over its inputs that compilers vectorize without reassociating any sum
+#define EXPORT_REAL (sizeof(Real) == sizeof(double) ? "double" : "float")
+
+internal void export_values(FILE *f, const Real *values, size_t cnt, size_t stride) {
+    const char *format = sizeof(Real) == sizeof(double) ? "%.17g" : "%.9gf";
+    for (size_t i = 0; i < cnt; i++) {
+        fprintf(f, i % 8 == 0 ? "\n        " : " ");
+        fprintf(f, format, values[i*stride]);
+        fprintf(f, ",");
+    }
+}
+
+bool export_model_c(RNA_Model *model, const char *source, char *out) {
+    char path[512], prefix[128], guard[128], shape[128];
+    // symbols are prefixed with the file name, turned into an identifier
+    const char *base = strrchr(out, '/') != NULL ? strrchr(out, '/') + 1 : out;
+    size_t len = 0;
+    if (*base >= '0' && *base <= '9') prefix[len++] = '_';
+    for (const char *c = base; *c != '\0' && len + 1 < sizeof(prefix); c++) {
+        bool alnum = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9');
+        prefix[len++] = alnum ? *c : '_';
+    }
+    prefix[len] = '\0';
+    for (size_t i = 0; i <= len; i++) {
+        guard[i] = prefix[i] >= 'a' && prefix[i] <= 'z' ? prefix[i] - 'a' + 'A' : prefix[i];
+    }
+
+    uint32_t inputs = model->weights_cnt[0];
+    uint32_t outputs = model->neuron_cnt[model->layer_count - 1];
+    // both files name the exported model, e.g. "models/a.model (784-64-32-10)"
+    int shape_len = snprintf(shape, sizeof(shape), "%s (%u", source, inputs);
+    for (size_t layer = 0; layer < model->layer_count && shape_len < (int) sizeof(shape); layer++) {
+        shape_len += snprintf(shape + shape_len, sizeof(shape) - shape_len, "-%u", model->neuron_cnt[layer]);
+    }
+    snprintf(path, sizeof(path), "%s.h", out);
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", path);
+        return false;
+    }
+
+    fprintf(f, "// Standalone forward pass generated from %s)\n", shape);
+    fprintf(f, "#ifndef %s_H\n#define %s_H\n\n#include <stdint.h>\n\n", guard, guard);
+    fprintf(f, "#define %s_INPUTS %u\n#define %s_OUTPUTS %u\n\n", guard, inputs, guard, outputs);
+    fprintf(f, "typedef %s %s_real;\n\n", EXPORT_REAL, prefix);
+    fprintf(f, "// Activations of the output layer for raw pixels (0..255, row major)\n");
+    fprintf(f, "void %s_forward(const uint8_t *pixels, %s_real *outputs);\n\n", prefix, prefix);
+    fprintf(f, "// Index of the largest output\n");
+    fprintf(f, "int %s_find_label(const uint8_t *pixels);\n\n", prefix);
+    fprintf(f, "#endif // %s_H\n", guard);
+    bool ok = !ferror(f);
+    if (fclose(f) != 0 || !ok) {
+        LOG_WRITE_ERROR(path);
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s.c", out);
+    f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot open file %s\n", path);
+        return false;
+    }
+
+    const char *real = EXPORT_REAL;
+    fprintf(f, "// Generated from %s), do not edit\n#include \"%s.h\"\n", shape, base);
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        uint32_t neurons = model->neuron_cnt[layer], cnt = model->weights_cnt[layer];
+        fprintf(f, "\n// layer %zu: weights[input][neuron]\n", layer);
+        fprintf(f, "static _Alignas(64) const %s layer_%zu_weights[%u][%u] = {", real, layer, cnt, neurons);
+        for (size_t w = 0; w < cnt; w++) {
+            fprintf(f, "\n    {");
+            export_values(f, model->weights[layer] + w, neurons, model->weights_stride[layer]);
+            fprintf(f, "\n    },");
+        }
+        fprintf(f, "\n};\n\n");
+        fprintf(f, "static _Alignas(64) const %s layer_%zu_biases[%u] = {", real, layer, neurons);
+        export_values(f, model->biases[layer], neurons, 1);
+        fprintf(f, "\n};\n");
+    }
+
+    fprintf(f, "\nstatic void sigmoid(%s *values, int cnt) {\n", real);
+    fprintf(f, "    for (int i = 0; i < cnt; i++) {\n");
+    fprintf(f, "        %s magnitude = values[i] < 0 ? -values[i] : values[i];\n", real);
+    fprintf(f, "        values[i] = (%s) .5 * (values[i] / (1 + magnitude) + 1);\n", real);
+    fprintf(f, "    }\n}\n");
+
+    fprintf(f, "\nvoid %s_forward(const uint8_t *pixels, %s_real *outputs) {\n", prefix, prefix);
+    for (size_t layer = 0; layer < model->layer_count; layer++) {
+        uint32_t neurons = model->neuron_cnt[layer], cnt = model->weights_cnt[layer];
+        fprintf(f, "%s    _Alignas(64) %s layer_%zu[%u] = {0};\n", layer > 0 ? "\n" : "", real, layer, neurons);
+        fprintf(f, "    for (int i = 0; i < %u; i++) {\n", cnt);
+        if (layer == 0) {
+            fprintf(f, "        if (pixels[i] == 0) continue; // most pixels are blank\n");
+            fprintf(f, "        %s x = pixels[i];\n", real);
+        } else {
+            fprintf(f, "        %s x = layer_%zu[i];\n", real, layer - 1);
+        }
+        fprintf(f, "        for (int n = 0; n < %u; n++) {\n", neurons);
+        fprintf(f, "            layer_%zu[n] += layer_%zu_weights[i][n] * x;\n", layer, layer);
+        fprintf(f, "        }\n    }\n\n");
+        fprintf(f, "    for (int n = 0; n < %u; n++) {\n", neurons);
+        if (layer == 0) {
+            fprintf(f, "        layer_0[n] = layer_0[n] * (%s) (1.0/255.0) + layer_0_biases[n];\n", real);
+        } else {
+            fprintf(f, "        layer_%zu[n] += layer_%zu_biases[n];\n", layer, layer);
+        }
+        fprintf(f, "    }\n");
+        fprintf(f, "    sigmoid(layer_%zu, %u);\n", layer, neurons);
+    }
+    fprintf(f, "\n    for (int n = 0; n < %u; n++) {\n", outputs);
+    fprintf(f, "        outputs[n] = layer_%u[n];\n    }\n}\n", model->layer_count - 1);
+
+    fprintf(f, "\nint %s_find_label(const uint8_t *pixels) {\n", prefix);
+    fprintf(f, "    %s_real outputs[%u];\n", prefix, outputs);
+    fprintf(f, "    %s_forward(pixels, outputs);\n", prefix);
+    fprintf(f, "    int label = 0;\n");
+    fprintf(f, "    for (int n = 1; n < %u; n++) {\n", outputs);
+    fprintf(f, "        if (outputs[n] > outputs[label]) label = n;\n");
+    fprintf(f, "    }\n\n    return label;\n}\n");
+    ok = !ferror(f);
+    if (fclose(f) != 0 || !ok) {
+        LOG_WRITE_ERROR(path);
+        return false;
+    }
 
-    printf("INFO: saved model to file %s\n", path);
     return true;
 }
 
 // Make sure to the the `neuron_cnt` in the model before initialization
 void init_model(RNA_Model *model, Data *data) {
-    allocate_model(model);
     if (model->training_parameters == NULL) {
         model->training_parameters = &default_parameters;
     }
 
+    uint32_t *weights_cnt = malloc(sizeof(*weights_cnt) * model->layer_count);
+    assert(weights_cnt != NULL);
     for (size_t layer = 0; layer < model->layer_count; layer++) {
-        model->values[layer] = malloc(sizeof(*model->values[layer]) * model->neuron_cnt[layer]);
-        assert(model->values[layer] != NULL);
-
-        model->errors[layer] = malloc(sizeof(*model->errors[layer]) * model->neuron_cnt[layer]);
-        assert(model->errors[layer] != NULL);
-
         if (layer == 0) {
-            model->weights_cnt[layer] = data->meta.cols*data->meta.rows;
+            weights_cnt[layer] = data->meta.cols*data->meta.rows;
         } else {
-            model->weights_cnt[layer] = model->neuron_cnt[layer - 1];
+            weights_cnt[layer] = model->neuron_cnt[layer - 1];
         }
-
-        // + 1 for bias
-        size_t total_weights = (model->weights_cnt[layer] + 1) * model->neuron_cnt[layer];
-        model->weights[layer] = malloc(sizeof(double)*total_weights);
     }
+
+    allocate_model(model, model->neuron_cnt, weights_cnt, true);
+    free(weights_cnt);
 }
 
 void denit_model(RNA_Model *model) {
-    for (size_t layer = 0; layer < model->layer_count; layer++) {
-        free(model->errors[layer]);
-        free(model->values[layer]);
-        free(model->weights[layer]);
+    if (model->_mapped != NULL) {
+        munmap(model->_mapped, model->_mapped_size);
+        model->_mapped = NULL;
     }
 
-    free(model->weights_cnt);
-    free(model->errors);
-    free(model->values);
-    free(model->weights);
-}
\ No newline at end of file
+    free(model->_arena);
+    model->_arena = NULL;
+}
@@ -1,6 +1,10 @@
+#ifndef TRAINING_H
+#define TRAINING_H
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 
 #define DA_APPEND(da, v) do {                                      \
     if ((da).capacity == 0 || (da).items == NULL) {                \
@@ -15,6 +19,13 @@
     (da).items[(da).count++] = v;                                  \
 } while (0)
 
+// Build with -DRNA_FLOAT32 to run training and inference in single precision
+#ifdef RNA_FLOAT32
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 typedef struct {
     size_t iteration;
     double value;
@@ -30,26 +41,105 @@ typedef struct {
     double tolerance;
     double lr;
     int max_iters;
+    int batch_size;            // samples per weight update, 1 = online SGD
+    int threads;               // workers training lock-free on shards of the data (Hogwild), 1 = serial, 0 = one per core
+    bool sync;                 // workers split every minibatch instead, results do not depend on `threads`
+    size_t checkpoint_every;   // samples between checkpoints, 0 = only when interrupted
+    char *checkpoint_path;     // NULL = `<model path>.ckpt`
+    bool warm_start;           // keep the current weights instead of randomizing them, set by the UI and `--init-from` only
     char *output_path;
     char *output_dir_path;
     char *config_path;
 } RNA_Parameters;
 
+// Position of a training run, updated after every step so a checkpoint can resume it exactly
+typedef struct {
+    int epoch;                 // epochs fully trained
+    size_t samples;            // samples trained in the current epoch
+    size_t chunk_first;        // first sample of the chunk being trained
+    size_t offset;             // next position inside that chunk (or inside every shard of it)
+    size_t round;              // samples per step and shards the offset was counted with,
+    uint32_t shards;           // a resumed run with other values restarts the epoch
+    size_t last_validation;    // samples trained, over all epochs, at the last validation
+    double error_sum;          // error accumulated since the last validation
+    bool resume;               // set by `load_checkpoint`, `train_model` continues from here
+} Training_Cursor;
+
+// What the training thread reports at every validation
 typedef struct {
-    double **weights;          // weigths of neuron `x` in the layer `y` = (weigths[y] + x*weights_cnt[y])
+    size_t iteration;
+    double error;
+    int epoch;
+    double samples_per_sec;    // since the previous report
+    double forward_secs;       // time spent in the forward and backward passes so far
+    double backward_secs;
+} Training_Metrics;
+
+// Lock-free single producer (training thread), single consumer (UI) ring of Training_Metrics.
+// The producer never waits: when the ring is full new reports are dropped and counted.
+// A run first reports the last TELEMETRY_REPLAY points of `error_hist` (the history of a resumed
+// run), a consumer wanting the older ones reads them from `error_hist` before starting the training
+#define TELEMETRY_CAPACITY 256 // power of two
+#define TELEMETRY_REPLAY (TELEMETRY_CAPACITY/2)
+typedef struct {
+    Training_Metrics items[TELEMETRY_CAPACITY];
+    atomic_size_t head;        // next slot to write, only stored by the producer
+    atomic_size_t tail;        // next slot to read, only stored by the consumer
+    atomic_size_t dropped;     // reports lost to a full ring, shown by the UI
+} Telemetry;
+
+struct Topology_Kernels;
+
+typedef struct {
+    Real **weights;            // weigths of neuron `x` in the layer `y` = (weigths[y] + x*weights_stride[y])
+    Real **biases;             // layer -> neuron -> bias
     uint32_t *weights_cnt;
+    uint32_t *weights_stride;  // weights_cnt padded so every row starts 64-byte aligned
     uint32_t *neuron_cnt;
     uint32_t layer_count;
+    void *_arena;              // single 64-byte aligned allocation backing every buffer of the model
+    void *_mapped;             // model file the weights point into when loaded with `map_model`
+    size_t _mapped_size;
+    const struct Topology_Kernels *_topology; // unrolled passes for this shape, NULL for the generic ones
 
     // transient fields
-    double **errors;          // layer -> neuron -> error
-    double **values;          // layer -> neuron -> values
+    Real **errors;            // layer -> neuron -> error
+    Real **values;            // layer -> neuron -> values
     RNA_Parameters *training_parameters;
-    bool training;
-    Error_Hist error_hist;
+    atomic_bool training;
+    Error_Hist error_hist;     // owned by the training thread while `training`, read `telemetry` meanwhile
+    Telemetry *telemetry;      // optional, receives every point added to `error_hist`
+    Real *_columns;            // layer 0 weights by input (rows of neuron_cnt[0]) while training on sparse
+                               // inputs, `weights[0]` is only updated from them at checkpoints and at the end
     int epoch;
+    bool interrupted;          // the last training was stopped by `stop_training`, its checkpoint is what to keep
+    double forward_secs;      // time spent in the forward and backward passes of the last training
+    double backward_secs;
+    uint32_t _timing_tick;    // samples trained one by one, see `train_sample`
+    uint64_t rng;             // xorshift64* state of the weight initialization
+    Training_Cursor cursor;
 } RNA_Model;
 
+// int8 post-training quantization of a model, inference only (see `quantize_model`)
+typedef struct {
+    int8_t **weights;          // rows of `weights_stride` values, real weight = weights[row][w] * scales[row]
+    float **scales;            // layer -> neuron -> scale of its row
+    float **biases;            // layer -> neuron -> bias
+    uint32_t *weights_cnt;
+    uint32_t *weights_stride;  // weights_cnt padded to 64
+    uint32_t *neuron_cnt;
+    uint32_t layer_count;
+    void *_arena;
+
+    // transient fields
+    uint8_t *input;            // quantized pixels
+    uint8_t **values;          // layer -> neuron -> quantized activation, zero padded to 64
+    float *output;             // activations of the last layer
+    int32_t *sums;             // integer dot products of the layer being computed
+} Quantized_Model;
+
+typedef struct Data_Stream Data_Stream;
+
 typedef struct {
     struct {
         uint32_t size;
@@ -57,17 +147,65 @@ typedef struct {
         uint32_t cols;
     } meta;
 
-    double *_images;
+    uint32_t stride;           // values between consecutive images (rows*cols, padded in dataset caches)
+    uint32_t loader_threads;   // workers `read_data` decodes with, set before loading (0 = one per core)
+    Real *_images;
+    uint8_t *pixels;           // raw pixels (0..255) when loaded with `map_data`, scaled by 1/255 in the first layer
     uint8_t *labels;
+
+    // mappings owned by `map_data`
+    struct {
+        void *images;
+        void *labels;
+        void *cache;           // dataset cache mapped by `read_data`
+        size_t images_size;
+        size_t labels_size;
+        size_t cache_size;
+    } _mapped;
+
+    Data_Stream *_stream;      // set by `open_data_stream`, images are only available chunk by chunk
+
+    // nonzero pixels of every image, built by the first per-sample training on the data
+    size_t *_nz_offsets;       // meta.size + 1 entries, image i owns entries [_nz_offsets[i], _nz_offsets[i + 1])
+    uint16_t *_nz_index;       // pixel of every entry
+    uint8_t *_nz_pixels;       // its raw value (1..255)
+
 } Data;
 
-bool load_model(char *in, RNA_Model *model); // Load model from file
+bool load_model(char *in, RNA_Model *model); // Load model from file (JRNA v1 or v2), weights are verified and copied
+bool map_model(char *in, RNA_Model *model); // Map a JRNA v2 file and point the weights into it (read only), falls back to `load_model`
 bool save_model(RNA_Model *model); // Saves model to a file
+bool save_checkpoint(RNA_Model *model, const char *path); // Saves weights, training position, RNG state, error history and parameters
+bool load_checkpoint(char *path, RNA_Model *model, RNA_Parameters *parameters); // Loads a checkpoint, `train_model` then resumes it (checkpoints also load as plain models)
+void stop_training(void); // Async-signal-safe: the running training writes a checkpoint and stops after its current step
 void init_model(RNA_Model *model, Data *data); // Initilize model (allocation and stuff)
 void denit_model(RNA_Model *model); // dealocate model
 bool train_model(RNA_Model *model, Data *training_data); // Train model using the training data (./data/train-*.ubyte)
 void train_model_async(RNA_Model *model, Data *training_data);
+bool poll_telemetry(Telemetry *telemetry, Training_Metrics *metrics); // Pops the oldest report, false when there is none (never blocks)
 bool test_model(RNA_Model *model); // Test model using the testing data (./data/tk10k-*.ubyte)
-int find_label(RNA_Model *model, double *image); // Find label (0..9) of given image
+int find_label(RNA_Model *model, Real *image); // Find label (0..9) of given image
+int find_label_at(RNA_Model *model, Data *data, size_t index); // Find label (0..9) of the image at `index` in data
+// Reentrant inference: labels the `count` images of `images` starting at `first` (a dataset or any view over
+// normalized images or raw pixels) and, when `scores` is not NULL, writes count x output neurons scores to it.
+// The model is only read and all scratch lives in `workspace`, which must hold `inference_workspace_size(model, count)`
+// bytes, so any number of threads can serve the same model with their own workspace
+size_t inference_workspace_size(const RNA_Model *model, size_t count);
+void infer_batch(const RNA_Model *model, const Data *images, size_t first, size_t count, void *workspace, uint8_t *labels, Real *scores);
+size_t evaluate_model(RNA_Model *model, Data *data, uint32_t threads, size_t batch_size); // Count images of `data` labeled correctly, batched forward passes on `threads` workers (0 = one per core, batch 0 = default)
+void quantize_model(const RNA_Model *model, Quantized_Model *quantized); // Quantize weights to int8 with one scale per row
+bool save_quantized_model(const Quantized_Model *model, char *out); // Saves a quantized model (JRNA v2, int8 dtype)
+bool load_quantized_model(char *in, Quantized_Model *model); // Loads a file of `save_quantized_model`
+void denit_quantized_model(Quantized_Model *model);
+int find_label_quantized(Quantized_Model *model, const uint8_t *pixels); // Find label (0..9) of raw pixels (0..255) with integer dot products
+bool export_model_c(RNA_Model *model, const char *source, char *out); // Writes `<out>.c` and `<out>.h`, a dependency-free forward pass with the weights compiled in, `source` names the model in their banners
 RNA_Parameters get_default_parameters(void); // Get parameters used in `init_model` when model.training_parameters == NULL
-bool read_data(const char *images_file_path, const char *labels_file_path, Data *data);
\ No newline at end of file
+bool read_data(const char *images_file_path, const char *labels_file_path, Data *data); // decode and normalize the IDX files, cached next to them in `<images_file_path>.cache`
+bool map_data(const char *images_file_path, const char *labels_file_path, Data *data); // mmap the IDX files, pixels stay as uint8
+bool open_data_stream(const char *images_file_path, const char *labels_file_path, size_t chunk_size, Data *data); // read the IDX files in chunks of `chunk_size` images on a background thread
+bool next_stream_chunk(Data_Stream *stream, Data *chunk); // next chunk of the epoch, false when the epoch is over
+void rewind_data_stream(Data_Stream *stream); // restart the stream at the first image
+bool data_stream_failed(Data_Stream *stream); // a read failed since the last rewind, the epoch ended by it is incomplete
+void denit_data(Data *data); // release memory of `read_data`, mappings of `map_data` or the stream of `open_data_stream`
+
+#endif // TRAINING_H
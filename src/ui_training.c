@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
+#include <signal.h>
 #include <raylib.h>
 #include <raymath.h>
 #include <math.h>
@@ -15,7 +16,7 @@
 #define LOG_1000 6.907755278982137
 
 #define SCREEN_WIDTH 510
-#define SCREEN_HEIGHT 480
+#define SCREEN_HEIGHT 510
 #define CHART_STEP_CNT 5
 #define CHART_STEP_LEN 8
 #define CHART_STEP_PAD 3
@@ -157,20 +158,39 @@ void print_results(int total, int correct) {
     printf("+------------------------+---------+\n");
 }
 
+#define STREAM_CHUNK_SIZE 4096 // images per buffer of the streamed training data
+
+static bool map_dataset = false; // --mmap
+static bool stream_dataset = false; // --stream
+static uint32_t loader_threads = 0; // --loader-threads
+static long seed = -1; // --seed, random when negative
+static uint32_t test_threads = 0; // --test --threads, one per core by default
+static size_t test_batch_size = 0; // --test --batch-size, images per forward pass
+
+bool load_data(const char *images_file_path, const char *labels_file_path, Data *data) {
+    data->loader_threads = loader_threads;
+    if (map_dataset) {
+        return map_data(images_file_path, labels_file_path, data);
+    }
+
+    return read_data(images_file_path, labels_file_path, data);
+}
+
 bool test_model(RNA_Model *model) {
     Data testing_data = {0};
-    if (!read_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &testing_data)) {
+    if (!load_data("data/t10k-images.idx3-ubyte", "data/t10k-labels.idx1-ubyte", &testing_data)) {
         return false;
     }
 
-    int correct_guesses = 0;
-    for (uint32_t i = 0; i < testing_data.meta.size; i++) {
-        double *image = testing_data._images + (i * testing_data.meta.cols * testing_data.meta.rows);
-        uint8_t label = find_label(model, image);
-        if (label == testing_data.labels[i]) correct_guesses++;
-    }
+    struct timespec start, end;
+    assert(clock_gettime(CLOCK_MONOTONIC, &start) >= 0);
+    int correct_guesses = evaluate_model(model, &testing_data, test_threads, test_batch_size);
+    assert(clock_gettime(CLOCK_MONOTONIC, &end) >= 0);
+    double ms = (end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)/1e6;
+    printf("INFO: evaluated %u images in %.2f ms\n", testing_data.meta.size, ms);
 
     print_results(testing_data.meta.size, correct_guesses);
+    denit_data(&testing_data);
     return true;
 }
 
@@ -196,40 +216,87 @@ void usage(char *program_name) {
     RNA_Parameters default_parameters = get_default_parameters();
     printf(
 "Usage:\n"
-"  %s --train [--out <output-file>] [--max-iters <n>] [--tolerance <value>] [--lr <rate>]\n"
-"  %s --test --model <model-file>\n"
+"  %s --train [--out <output-file>] [--max-iters <n>] [--tolerance <value>] [--lr <rate>] [--batch-size <n>] [--threads <n>] [--sync] [--seed <n>] [--mmap] [--stream] [--loader-threads <n>] [--checkpoint <file>] [--checkpoint-every <n>] [--resume <file>] [--init-from <model-file>]\n"
+"  %s --test --model <model-file> [--threads <n>] [--batch-size <n>] [--mmap] [--loader-threads <n>]\n"
+"  %s --export-c <model-file> [--out <name>]\n"
 "  %s --help\n",
-    program_name, program_name, program_name);
+    program_name, program_name, program_name, program_name);
 
     printf(
 "\nOptions:\n"
 "  --help               Prints this message.\n"
 "  --train              Train a new model.\n"
 "  --test               Run test data on the model.\n"
+"  --export-c <file>    Write the model as dependency-free C, <name>.c and <name>.h [default name: rna_model].\n"
 "  --model <file>       Input model file (required for GUI).\n"
 "  --out <file>         Output file for the trained model.\n"
 "  --out-dir <file>     Output directory for the trained model.\n"
 "  --max-iters <n>      Maximum number of iterations [default: %d].\n"
-"  --config <file>      Parse configs (lr, tolerance, max-iters) from a file.\n"
+"  --config <file>      Parse configs (lr, tolerance, max-iters, batch size, threads, sync) from a file.\n"
 "  --tolerance <value>  Sets the minimum error required to stop training early [default: %.3f].\n"
-"  --lr <rate>          Learning rate [default: %.3f].\n",
-    default_parameters.max_iters, default_parameters.tolerance, default_parameters.lr);
+"  --lr <rate>          Learning rate [default: %.3f].\n"
+"  --batch-size <n>     Samples per weight update, batches run as matrix products [default: %d].\n"
+"                       With --test, images per forward pass [default: 64].\n"
+"  --threads <n>        Workers training lock-free on shards of the data, 0 = one per core [default: %d].\n"
+"                       With --test, evaluation workers [default: one per core].\n"
+"  --sync               Split every minibatch across the threads, results are identical for any thread count.\n"
+"  --seed <n>           Seed of the initial weights [default: random].\n"
+"  --mmap               Map the dataset instead of reading it, pixels stay as bytes.\n"
+"  --stream             Stream the training data from disk in chunks instead of loading it.\n"
+"  --loader-threads <n> Threads used to decode the dataset [default: one per core].\n"
+"  --checkpoint <file>  Checkpoint written while training and on Ctrl-C [default: <output-file>.ckpt].\n"
+"  --checkpoint-every <n> Samples between checkpoints, 0 = only on Ctrl-C [default: 0].\n"
+"  --resume <file>      Continue the training saved in a checkpoint, its parameters are the defaults.\n"
+"  --init-from <file>   Start training from the weights of a model file instead of random ones.\n",
+    default_parameters.max_iters, default_parameters.tolerance, default_parameters.lr, default_parameters.batch_size, default_parameters.threads);
+}
+
+void handle_interrupt(int signal) {
+    (void) signal;
+    stop_training();
 }
 
 #define X_ALIGN_DISTANCE 200
-bool init_training(RNA_Parameters *training_parameters) {
-    srand(time(NULL));
+// `from` is a model from `load_checkpoint` or `load_model` to continue training, NULL to train a new one
+bool init_training(RNA_Parameters *training_parameters, RNA_Model *from) {
+    srand(seed >= 0 ? (unsigned int) seed : (unsigned int) time(NULL));
     static const char *images_file_path = "./data/train-images.idx3-ubyte";
     static const char *labels_file_path = "./data/train-labels.idx1-ubyte";
 
     Data data = {0};
-    if (!read_data(images_file_path, labels_file_path, &data)) {
+    bool loaded = stream_dataset
+        ? open_data_stream(images_file_path, labels_file_path, STREAM_CHUNK_SIZE, &data)
+        : load_data(images_file_path, labels_file_path, &data);
+    if (!loaded) {
         return false;
     }
 
     RNA_Model model = { .neuron_cnt = (uint32_t []) {64, 32, 10}, .layer_count = 3, .training_parameters = training_parameters };
+    if (from == NULL) {
+        init_model(&model, &data);
+    } else if (from->weights_cnt[0] != data.meta.rows*data.meta.cols) {
+        fprintf(stderr, "ERROR: model expects %u inputs, training images have %u\n", from->weights_cnt[0], data.meta.rows*data.meta.cols);
+        denit_data(&data);
+        return false;
+    } else {
+        model = *from;
+        model.training_parameters = training_parameters;
+    }
+
+    static Telemetry telemetry;
+    model.telemetry = &telemetry;
 
-    init_model(&model, &data);
+    // a resumed run only reports the tail of its history, the chart starts with the older points
+    Chart chart = {0};
+    size_t replayed = model.error_hist.count < TELEMETRY_REPLAY ? model.error_hist.count : TELEMETRY_REPLAY;
+    for (size_t e = 0; model.cursor.resume && e + replayed < model.error_hist.count; e++) {
+        chart_add_dp(&chart, (Vector2) { .x = (double) model.error_hist.items[e].iteration, .y = model.error_hist.items[e].value });
+    }
+
+    // the first Ctrl-C checkpoints and stops the training, a second one kills the program
+    struct sigaction action = { .sa_handler = handle_interrupt, .sa_flags = SA_RESETHAND };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
     train_model_async(&model, &data);
 
     SetTraceLogLevel(LOG_ERROR);
@@ -238,33 +305,37 @@ bool init_training(RNA_Parameters *training_parameters) {
     font = LoadFont_CourierPrimeRegular();
     SetTextureFilter(font.texture, TEXTURE_FILTER_TRILINEAR);
 
-    Chart chart = {0};
     chart.width = 350;
     chart.height = 250;
 
     int padding_x = SCREEN_WIDTH/2 - chart.width/2;
     int padding_y = 30;
+    Training_Metrics last = {0}, metrics;
     while (!WindowShouldClose()) {
-        size_t new_data_count = model.error_hist.count - chart.points.count;
-        for (size_t i = 0; i < new_data_count; i++) {
-            Error new = model.error_hist.items[chart.points.count];
-            chart_add_dp(&chart, (Vector2) { .x = (double) new.iteration, .y = new.value });
+        // `error_hist` belongs to the training thread, the UI only sees its reports
+        while (poll_telemetry(&telemetry, &metrics)) {
+            chart_add_dp(&chart, (Vector2) { .x = (double) metrics.iteration, .y = metrics.error });
+            last = metrics;
         }
 
         if (!model.training && IsKeyPressed(KEY_T) && !test_model(&model)) {
             printf("ERROR: could not test model\n");
         }
 
-        if (!model.training && IsKeyPressed(KEY_SPACE)) {
+        // space trains again from random weights, R fine-tunes the current ones
+        bool retrain = IsKeyPressed(KEY_SPACE), fine_tune = IsKeyPressed(KEY_R);
+        if (!model.training && (retrain || fine_tune)) {
+            while (poll_telemetry(&telemetry, &metrics));
             chart.points.count = 0;
             chart.max_x = 0;
+            atomic_store_explicit(&telemetry.dropped, 0, memory_order_relaxed);
+            training_parameters->warm_start = fine_tune;
             train_model_async(&model, &data);
         }
 
         BeginDrawing();
 
-        if (model.error_hist.count > 0) {
-            Error last_error = model.error_hist.items[model.error_hist.count - 1];
+        if (chart.points.count > 0) {
             chart_draw(padding_x, padding_y, chart);
 
             draw_boolean(padding_x, padding_y*3 + chart.height, "Training", model.training);
@@ -272,9 +343,13 @@ bool init_training(RNA_Parameters *training_parameters) {
             draw_float(padding_x, padding_y*4 + chart.height, "Tolerance", model.training_parameters->tolerance);
             draw_float(padding_x + X_ALIGN_DISTANCE, padding_y*4 + chart.height, "LR", model.training_parameters->lr);
 
-            draw_int(padding_x, padding_y*5 + chart.height, "Epoch", model.epoch);
-            draw_int(padding_x + X_ALIGN_DISTANCE, padding_y*5 + chart.height, "Iteration", last_error.iteration);
-            draw_float(padding_x, padding_y*6 + chart.height, "Error", last_error.value);
+            draw_int(padding_x, padding_y*5 + chart.height, "Epoch", last.epoch);
+            draw_int(padding_x + X_ALIGN_DISTANCE, padding_y*5 + chart.height, "Iteration", last.iteration);
+            draw_float(padding_x, padding_y*6 + chart.height, "Error", last.error);
+            draw_int(padding_x + X_ALIGN_DISTANCE, padding_y*6 + chart.height, "Images/s", (long) last.samples_per_sec);
+            draw_float(padding_x, padding_y*7 + chart.height, "Forward s", last.forward_secs);
+            draw_float(padding_x + X_ALIGN_DISTANCE, padding_y*7 + chart.height, "Backward s", last.backward_secs);
+            draw_int(padding_x, padding_y*8 + chart.height, "Dropped", (long) atomic_load_explicit(&telemetry.dropped, memory_order_relaxed));
         }
 
         ClearBackground((Color){.r = 220, .g = 220, .b = 220, .a = 255});
@@ -297,8 +372,31 @@ int main(int argc, char **argv) {
     char *parameter = shift(&argc, &argv);
     if (strcmp(parameter, "--train") == 0) {
         RNA_Parameters training_parameters = get_default_parameters();
+        RNA_Model loaded = {0};
+        // the checkpoint parameters are loaded first so the other options can override them
+        for (int i = 0; i + 1 < argc; i++) {
+            if (strcmp(argv[i], "--resume") == 0 && !load_checkpoint(argv[i + 1], &loaded, &training_parameters)) {
+                return 1;
+            }
+        }
+
         while (argc > 0) {
             parameter = shift(&argc, &argv);
+            if (strcmp(parameter, "--mmap") == 0) {
+                map_dataset = true;
+                continue;
+            }
+
+            if (strcmp(parameter, "--stream") == 0) {
+                stream_dataset = true;
+                continue;
+            }
+
+            if (strcmp(parameter, "--sync") == 0) {
+                training_parameters.sync = true;
+                continue;
+            }
+
             if (argc == 0) {
                 fprintf(stderr, "ERROR: missing parameter '%s' value\n", parameter);
                 usage(program_name);
@@ -312,18 +410,43 @@ int main(int argc, char **argv) {
                 training_parameters.tolerance = atof(value);
             } else if (strcmp(parameter, "--lr") == 0) {
                 training_parameters.lr = atof(value);
+            } else if (strcmp(parameter, "--batch-size") == 0) {
+                training_parameters.batch_size = atoi(value);
+            } else if (strcmp(parameter, "--threads") == 0) {
+                training_parameters.threads = atoi(value);
+            } else if (strcmp(parameter, "--seed") == 0) {
+                seed = atol(value);
             } else if (strcmp(parameter, "--out") == 0) {
                 training_parameters.output_path = value;
             } else if (strcmp(parameter, "--out-dir") == 0) {
                 training_parameters.output_dir_path = value;
             } else if (strcmp(parameter, "--config") == 0) {
                 training_parameters.config_path = value;
+            } else if (strcmp(parameter, "--loader-threads") == 0) {
+                loader_threads = atoi(value);
+            } else if (strcmp(parameter, "--checkpoint") == 0) {
+                training_parameters.checkpoint_path = value;
+            } else if (strcmp(parameter, "--checkpoint-every") == 0) {
+                training_parameters.checkpoint_every = strtoull(value, NULL, 10);
+            } else if (strcmp(parameter, "--resume") == 0) {
+                continue;
+            } else if (strcmp(parameter, "--init-from") == 0) {
+                if (loaded.layer_count > 0) {
+                    fprintf(stderr, "ERROR: --init-from cannot be combined with --resume or given twice\n");
+                    return 1;
+                }
+
+                if (!load_model(value, &loaded)) {
+                    return 1;
+                }
+
+                training_parameters.warm_start = true;
             } else {
                 fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
             }
         }
 
-        if (!init_training(&training_parameters)) {
+        if (!init_training(&training_parameters, loaded.layer_count > 0 ? &loaded : NULL)) {
             return 1;
         }
 
@@ -341,9 +464,54 @@ int main(int argc, char **argv) {
         }
 
         char *model_path = shift(&argc, &argv);
+        while (argc > 0) {
+            parameter = shift(&argc, &argv);
+            if (strcmp(parameter, "--mmap") == 0) {
+                map_dataset = true;
+            } else if (strcmp(parameter, "--loader-threads") == 0 && argc > 0) {
+                loader_threads = atoi(shift(&argc, &argv));
+            } else if (strcmp(parameter, "--threads") == 0 && argc > 0) {
+                test_threads = atoi(shift(&argc, &argv));
+            } else if (strcmp(parameter, "--batch-size") == 0 && argc > 0) {
+                test_batch_size = atoi(shift(&argc, &argv));
+            } else {
+                fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
+            }
+        }
+
         if (!load_model_and_test(model_path)) {
             return 1;
         }
+    } else if (strcmp(parameter, "--export-c") == 0) {
+        if (argc == 0) {
+            fprintf(stderr, "ERROR: missing parameter '--export-c' value\n");
+            usage(program_name);
+            return 1;
+        }
+
+        char *model_path = shift(&argc, &argv);
+        char *out = "rna_model";
+        while (argc > 0) {
+            parameter = shift(&argc, &argv);
+            if (strcmp(parameter, "--out") == 0 && argc > 0) {
+                out = shift(&argc, &argv);
+            } else {
+                fprintf(stderr, "WARNING: ignoring unknow parameter %s\n", parameter);
+            }
+        }
+
+        RNA_Model model = {0};
+        if (!load_model(model_path, &model)) {
+            return 1;
+        }
+
+        if (!export_model_c(&model, model_path, out)) {
+            fprintf(stderr, "ERROR: failed to export model\n");
+            return 1;
+        }
+
+        printf("INFO: exported model to %s.c and %s.h\n", out, out);
+        denit_model(&model);
     } else if (strcmp(parameter, "--help") == 0) {
         usage(program_name);
     } else {